@@ -21,19 +21,49 @@
 #ifndef DISTRHO_PLUGIN_INFO_H_INCLUDED
 #define DISTRHO_PLUGIN_INFO_H_INCLUDED
 
-#define DISTRHO_PLUGIN_NAME    "Yoshimi"
-#define DISTRHO_PLUGIN_AUTHOR  "Andrew Deryabin"
-#define DISTRHO_PLUGIN_URI     "https://github.com/yoshimi/yoshimi"
-#define DISTRHO_PLUGIN_CLAP_ID "yoshimi"
+#define DISTRHO_PLUGIN_AUTHOR "Andrew Deryabin"
+
+/*
+ * Multi-output variant (CMake option MultiOutputPlugin).
+ * Besides the main mix, the first YOSHIMI_PLUGIN_NUM_PART_BUSES parts get their own stereo bus.
+ *
+ * A part set to "part output only" is left out of the main mix by the engine. Without a bus of
+ * its own (any part on the single-output variant, parts past the buses on multi-output) it is
+ * therefore silent, as it always was. The setting itself is kept, so it is saved unchanged.
+ */
+#if YOSHIMI_PLUGIN_MULTI_OUTPUT
+#define DISTRHO_PLUGIN_NAME          "Yoshimi Multi"
+#define DISTRHO_PLUGIN_URI           "https://github.com/yoshimi/yoshimi#multi"
+#define DISTRHO_PLUGIN_CLAP_ID       "yoshimi.multi"
+#define YOSHIMI_PLUGIN_NUM_PART_BUSES 16
+#else
+#define DISTRHO_PLUGIN_NAME          "Yoshimi"
+#define DISTRHO_PLUGIN_URI           "https://github.com/yoshimi/yoshimi"
+#define DISTRHO_PLUGIN_CLAP_ID       "yoshimi"
+#define YOSHIMI_PLUGIN_NUM_PART_BUSES 0
+#endif
 
 #define DISTRHO_PLUGIN_IS_RT_SAFE  1
 #define DISTRHO_PLUGIN_IS_SYNTH    1
 #define DISTRHO_PLUGIN_NUM_INPUTS  2
-#define DISTRHO_PLUGIN_NUM_OUTPUTS 2
+#define DISTRHO_PLUGIN_NUM_OUTPUTS (2 + YOSHIMI_PLUGIN_NUM_PART_BUSES * 2)
 
 #define DISTRHO_PLUGIN_WANT_STATE         1
 #define DISTRHO_PLUGIN_WANT_DIRECT_ACCESS 1
 
+// Host-automatable parameters. See YoshimiAutomation.
+// Part parameters are laid out part by part, for the first YOSHIMI_PLUGIN_NUM_AUTOMATED_PARTS parts.
+#define YOSHIMI_PLUGIN_NUM_AUTOMATED_PARTS 16
+
+enum Parameters {
+    kParameterMasterVolume = 0,
+    kParameterGlobalDetune,
+    kParameterKeyShift,
+    kParameterPartVolume,
+    kParameterPartPanning = kParameterPartVolume + YOSHIMI_PLUGIN_NUM_AUTOMATED_PARTS,
+    kParameterCount       = kParameterPartPanning + YOSHIMI_PLUGIN_NUM_AUTOMATED_PARTS
+};
+
 // Enable UI
 #define DISTRHO_PLUGIN_HAS_UI          1
 #define DISTRHO_PLUGIN_HAS_EXTERNAL_UI 0
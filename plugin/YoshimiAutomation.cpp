@@ -0,0 +1,250 @@
+/*
+    YoshimiAutomation
+
+    Copyright 2023, AnClark Liu <anclarkliu@outlook.com>
+
+    This file is part of yoshimi, which is free software: you can
+    redistribute it and/or modify it under the terms of the GNU General
+    Public License as published by the Free Software Foundation, either
+    version 2 of the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with yoshimi.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "YoshimiAutomation.h"
+
+#include "Misc/SynthEngine.h"
+#include "Misc/Part.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Glide time of smoothed parameters, in seconds
+static constexpr float kSmoothingTime = 0.02f;
+
+YoshimiAutomation::YoshimiAutomation()
+    : fTargetsChanged(false)
+    , fResync(false)
+    , fRampsLeft(0)
+{
+    for (uint32_t i = 0; i < kParameterCount; ++i) {
+        DISTRHO::Parameter parameter;
+        initParameter(i, parameter);
+
+        fTargets[i].store(parameter.ranges.def);
+        fCurrent[i]     = parameter.ranges.def;
+        fLastTargets[i] = parameter.ranges.def;
+        fSteps[i]       = 0.0f;
+    }
+}
+
+void YoshimiAutomation::initParameter(uint32_t index, DISTRHO::Parameter& parameter)
+{
+    // Defaults are the ones of a fresh Yoshimi instance
+    parameter.hints = DISTRHO::kParameterIsAutomatable;
+
+    switch (index) {
+        case kParameterMasterVolume:
+            parameter.name       = "Master Volume";
+            parameter.symbol     = "master_volume";
+            parameter.ranges.min = 0.0f;
+            parameter.ranges.max = 127.0f;
+            parameter.ranges.def = 90.0f;
+            return;
+
+        case kParameterGlobalDetune:
+            parameter.name       = "Global Detune";
+            parameter.symbol     = "global_detune";
+            parameter.ranges.min = 0.0f;
+            parameter.ranges.max = 127.0f;
+            parameter.ranges.def = 64.0f;
+            return;
+
+        case kParameterKeyShift:
+            parameter.hints |= DISTRHO::kParameterIsInteger;
+            parameter.name       = "Key Shift";
+            parameter.symbol     = "key_shift";
+            parameter.ranges.min = -36.0f;
+            parameter.ranges.max = 36.0f;
+            parameter.ranges.def = 0.0f;
+            return;
+    }
+
+    char name[32], symbol[32];
+
+    if (index < kParameterPartPanning) {
+        const uint32_t npart = index - kParameterPartVolume;
+        snprintf(name, sizeof(name), "Part %u Volume", npart + 1);
+        snprintf(symbol, sizeof(symbol), "part%u_volume", npart + 1);
+        parameter.ranges.def = 96.0f;
+    } else {
+        const uint32_t npart = index - kParameterPartPanning;
+        snprintf(name, sizeof(name), "Part %u Panning", npart + 1);
+        snprintf(symbol, sizeof(symbol), "part%u_panning", npart + 1);
+        parameter.ranges.def = 64.0f;
+    }
+
+    parameter.name       = name;
+    parameter.symbol     = symbol;
+    parameter.ranges.min = 0.0f;
+    parameter.ranges.max = 127.0f;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+// Any thread
+
+float YoshimiAutomation::getValue(uint32_t index) const
+{
+    if (index >= kParameterCount)
+        return 0.0f;
+
+    return fTargets[index].load(std::memory_order_relaxed);
+}
+
+void YoshimiAutomation::setValue(uint32_t index, float value)
+{
+    if (index >= kParameterCount)
+        return;
+
+    fTargets[index].store(value, std::memory_order_relaxed);
+    fTargetsChanged.store(true, std::memory_order_release);
+}
+
+void YoshimiAutomation::syncFromEngine(SynthEngine* synth)
+{
+    /*
+     * Engine already holds these values, so there is nothing to apply. Audio thread reads them
+     * back as well on its next tick(), rather than taking over the targets: a host may set
+     * a parameter in between, and that value must still reach the engine.
+     */
+    for (uint32_t i = 0; i < kParameterCount; ++i)
+        fTargets[i].store(_read(synth, i), std::memory_order_relaxed);
+
+    fResync.store(true, std::memory_order_release);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+// Audio thread
+
+void YoshimiAutomation::tick(SynthEngine* synth, uint32_t frames)
+{
+    // Start over from what the engine holds. No target is known as applied, all are checked below.
+    const bool resync = fResync.exchange(false, std::memory_order_acquire);
+    if (resync) {
+        for (uint32_t i = 0; i < kParameterCount; ++i) {
+            fCurrent[i]     = _read(synth, i);
+            fLastTargets[i] = std::numeric_limits<float>::quiet_NaN();
+            fSteps[i]       = 0.0f;
+        }
+        fRampsLeft = 0;
+    }
+
+    if (fTargetsChanged.exchange(false, std::memory_order_acquire) || resync) {
+        const float rampFrames = std::max(1.0f, synth->samplerate_f * kSmoothingTime);
+        bool        changed    = false;
+
+        for (uint32_t i = 0; i < kParameterCount; ++i) {
+            const float target = fTargets[i].load(std::memory_order_relaxed);
+            if (target == fLastTargets[i])
+                continue;
+
+            fLastTargets[i] = target;
+
+            // Engine already there (typically right after a resync)
+            if (target == fCurrent[i] && fSteps[i] == 0.0f)
+                continue;
+
+            changed = true;
+
+            if (_isSmoothed(i)) {
+                const bool wasRamping = fSteps[i] != 0.0f;
+                fSteps[i]             = (target - fCurrent[i]) / rampFrames;
+
+                if (fSteps[i] != 0.0f && !wasRamping)
+                    ++fRampsLeft;
+                else if (fSteps[i] == 0.0f && wasRamping)
+                    --fRampsLeft;
+            } else {
+                fCurrent[i] = target;
+                _apply(synth, i, target);
+            }
+        }
+
+        // Values no longer match the last saved state
+        if (changed)
+            synth->setNeedsSaving(true);
+    }
+
+    if (fRampsLeft == 0)
+        return;
+
+    for (uint32_t i = 0; i < kParameterCount; ++i) {
+        if (fSteps[i] == 0.0f)
+            continue;
+
+        fCurrent[i] += fSteps[i] * frames;
+
+        if ((fSteps[i] > 0.0f && fCurrent[i] >= fLastTargets[i])
+            || (fSteps[i] < 0.0f && fCurrent[i] <= fLastTargets[i])) {
+            fCurrent[i] = fLastTargets[i];
+            fSteps[i]   = 0.0f;
+            --fRampsLeft;
+        }
+
+        _apply(synth, i, fCurrent[i]);
+    }
+}
+
+bool YoshimiAutomation::_isSmoothed(uint32_t index)
+{
+    return index == kParameterMasterVolume || index >= kParameterPartVolume;
+}
+
+float YoshimiAutomation::_read(SynthEngine* synth, uint32_t index)
+{
+    switch (index) {
+        case kParameterMasterVolume:
+            return synth->Pvolume;
+
+        case kParameterGlobalDetune:
+            return synth->microtonal.Pglobalfinedetune;
+
+        case kParameterKeyShift:
+            return synth->Pkeyshift - 64;
+    }
+
+    if (index < kParameterPartPanning)
+        return synth->part[index - kParameterPartVolume]->Pvolume;
+    else
+        return synth->part[index - kParameterPartPanning]->Ppanning;
+}
+
+void YoshimiAutomation::_apply(SynthEngine* synth, uint32_t index, float value)
+{
+    switch (index) {
+        case kParameterMasterVolume:
+            synth->setPvolume(value);
+            return;
+
+        case kParameterGlobalDetune:
+            synth->microtonal.Pglobalfinedetune = value;
+            synth->setAllPartMaps();
+            return;
+
+        case kParameterKeyShift:
+            synth->setPkeyshift(lrintf(value) + 64);
+            return;
+    }
+
+    if (index < kParameterPartPanning)
+        synth->part[index - kParameterPartVolume]->setVolume(value);
+    else
+        synth->part[index - kParameterPartPanning]->setPan(value);
+}
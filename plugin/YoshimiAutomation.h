@@ -0,0 +1,74 @@
+/*
+    YoshimiAutomation
+
+    Copyright 2023, AnClark Liu <anclarkliu@outlook.com>
+
+    This file is part of yoshimi, which is free software: you can
+    redistribute it and/or modify it under the terms of the GNU General
+    Public License as published by the Free Software Foundation, either
+    version 2 of the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with yoshimi.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef YOSHIMI_AUTOMATION_H
+#define YOSHIMI_AUTOMATION_H
+
+#include "DistrhoPlugin.hpp"
+
+#include <atomic>
+
+// Forward decls.
+class SynthEngine;
+
+/**
+ * Host-automatable parameters (see enum Parameters in DistrhoPluginInfo.h).
+ *
+ * Hosts may set values from any thread. They are only stored here, and applied by the
+ * audio thread right before each MasterAudio() chunk, directly through the engine's
+ * setters: no InterChange command and no state round trip is involved.
+ *
+ * Volumes and pannings glide to new values over kSmoothingTime, so automation does not
+ * zipper. Other parameters are applied as they come.
+ */
+class YoshimiAutomation {
+    std::atomic<float> fTargets[kParameterCount]; // Written by host, read by audio thread
+    std::atomic<bool>  fTargetsChanged;
+    std::atomic<bool>  fResync;
+
+    // Audio thread only
+    float    fCurrent[kParameterCount];
+    float    fLastTargets[kParameterCount];
+    float    fSteps[kParameterCount];
+    uint32_t fRampsLeft; // Number of parameters still gliding
+
+public:
+    YoshimiAutomation();
+
+    static void initParameter(uint32_t index, DISTRHO::Parameter& parameter);
+
+    // Any thread
+    float getValue(uint32_t index) const;
+    void  setValue(uint32_t index, float value);
+
+    // Read back values from engine (after a state was loaded). Non-RT.
+    // Values set by host afterwards still apply. Note that host parameters
+    // do not follow engine changes made otherwise (MIDI CC, editor commands).
+    void syncFromEngine(SynthEngine* synth);
+
+    // Audio thread. Apply values for the next `frames` rendered.
+    void tick(SynthEngine* synth, uint32_t frames);
+
+private:
+    static bool _isSmoothed(uint32_t index);
+    static float _read(SynthEngine* synth, uint32_t index);
+    static void _apply(SynthEngine* synth, uint32_t index, float value);
+};
+
+#endif
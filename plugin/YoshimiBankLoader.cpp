@@ -0,0 +1,67 @@
+/*
+    YoshimiBankLoader
+
+    Copyright 2023, AnClark Liu <anclarkliu@outlook.com>
+
+    This file is part of yoshimi, which is free software: you can
+    redistribute it and/or modify it under the terms of the GNU General
+    Public License as published by the Free Software Foundation, either
+    version 2 of the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with yoshimi.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "YoshimiBankLoader.h"
+#include "Misc/SynthEngine.h"
+
+#include <chrono>
+#include <string>
+
+YoshimiBankLoader::YoshimiBankLoader()
+    : fReady(false)
+{
+}
+
+YoshimiBankLoader::~YoshimiBankLoader()
+{
+    // Scan cannot be interrupted, engine must outlive it
+    wait();
+}
+
+void YoshimiBankLoader::start(SynthEngine* synth)
+{
+    std::lock_guard<std::mutex> lock(fThreadMutex);
+
+    fReady.store(false, std::memory_order_release);
+
+    fThread = std::thread([this, synth]() {
+        const auto begin = std::chrono::steady_clock::now();
+
+        /*
+         * Perform further global initialisation.
+         * For stand-alone the equivalent init happens in main(),
+         * after mainCreateNewInstance() returned successfully.
+         */
+        synth->installBanks();
+        synth->loadHistory();
+
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+        synth->getRuntime().Log("Banks installed in " + std::to_string(elapsed.count()) + " ms");
+
+        fReady.store(true, std::memory_order_release);
+    });
+}
+
+void YoshimiBankLoader::wait()
+{
+    std::lock_guard<std::mutex> lock(fThreadMutex);
+
+    if (fThread.joinable())
+        fThread.join();
+}
@@ -0,0 +1,66 @@
+/*
+    YoshimiBankLoader
+
+    Copyright 2023, AnClark Liu <anclarkliu@outlook.com>
+
+    This file is part of yoshimi, which is free software: you can
+    redistribute it and/or modify it under the terms of the GNU General
+    Public License as published by the Free Software Foundation, either
+    version 2 of the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with yoshimi.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef YOSHIMI_BANK_LOADER_H
+#define YOSHIMI_BANK_LOADER_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+// Forward decls.
+class SynthEngine;
+
+/**
+ * Install banks and instrument history off the plugin constructor.
+ *
+ * SynthEngine::installBanks() walks every bank root and instrument file on disk, once per
+ * instance. Hosts instantiate plugins one after another (or all at once when opening a project),
+ * so this used to dominate instantiation time. It now runs on a background thread instead.
+ *
+ * Each instance scans on its own thread, and instances opened together scan concurrently.
+ * They used to take turns on a process-wide mutex, which only made each one wait for all
+ * earlier scans: the first state save / load of the last instance stalled the longest.
+ * The time each scan takes is logged, so that it can be compared on real bank sets.
+ *
+ * Until isReady(), nothing but the loader thread may touch the engine's bank.
+ * Anything that needs it (state save / load, editor's bank list) calls wait() first.
+ */
+class YoshimiBankLoader {
+    std::thread       fThread;
+    std::mutex        fThreadMutex;
+    std::atomic<bool> fReady;
+
+public:
+    YoshimiBankLoader();
+    ~YoshimiBankLoader();
+
+    void start(SynthEngine* synth);
+
+    // Any thread. Wait-free, usable from the audio thread.
+    bool isReady() const { return fReady.load(std::memory_order_acquire); }
+
+    // Non-RT. Block until banks are installed.
+    void wait();
+
+    YoshimiBankLoader(const YoshimiBankLoader&)            = delete;
+    YoshimiBankLoader& operator=(const YoshimiBankLoader&) = delete;
+};
+
+#endif
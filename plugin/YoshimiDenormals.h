@@ -0,0 +1,80 @@
+/*
+    YoshimiDenormals
+
+    Copyright 2023, AnClark Liu <anclarkliu@outlook.com>
+
+    This file is part of yoshimi, which is free software: you can
+    redistribute it and/or modify it under the terms of the GNU General
+    Public License as published by the Free Software Foundation, either
+    version 2 of the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with yoshimi.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef YOSHIMI_DENORMALS_H
+#define YOSHIMI_DENORMALS_H
+
+#include <cstdint>
+
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#endif
+
+/**
+ * Flush denormals to zero for the lifetime of this object, then restore the previous FPU mode.
+ *
+ * Every voice runs its own AnalogFilter / SVFilter (and SUBnote its bandpass bank). When notes
+ * decay, the feedback state of those IIR filters sinks into denormal range, where each operation
+ * is many times slower. Hosts do not reliably set FTZ / DAZ for us, and the control register is
+ * per thread, so it is set around every run() and restored before returning to the host.
+ */
+class ScopedDenormalsDisable {
+#if defined(__SSE__) || defined(__x86_64__)
+    unsigned int fSavedMode;
+
+public:
+    ScopedDenormalsDisable()
+        : fSavedMode(_mm_getcsr())
+    {
+        // FTZ (bit 15) | DAZ (bit 6)
+        _mm_setcsr(fSavedMode | 0x8040);
+    }
+
+    ~ScopedDenormalsDisable()
+    {
+        _mm_setcsr(fSavedMode);
+    }
+#elif defined(__aarch64__)
+    uint64_t fSavedMode;
+
+public:
+    ScopedDenormalsDisable()
+    {
+        __asm__ __volatile__("mrs %0, fpcr" : "=r"(fSavedMode));
+
+        // FZ (bit 24)
+        const uint64_t mode = fSavedMode | (1ULL << 24);
+        __asm__ __volatile__("msr fpcr, %0" : : "r"(mode));
+    }
+
+    ~ScopedDenormalsDisable()
+    {
+        __asm__ __volatile__("msr fpcr, %0" : : "r"(fSavedMode));
+    }
+#else
+public:
+    ScopedDenormalsDisable() { }
+    ~ScopedDenormalsDisable() { }
+#endif
+
+    ScopedDenormalsDisable(const ScopedDenormalsDisable&)            = delete;
+    ScopedDenormalsDisable& operator=(const ScopedDenormalsDisable&) = delete;
+};
+
+#endif
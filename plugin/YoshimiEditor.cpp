@@ -24,26 +24,36 @@
 
 #include "Exchange/Exchange.hpp"
 
+#include <algorithm>
+#include <cstring>
+
 // these two are both zero and repesented by an enum entry
 constexpr unsigned char TYPE_READ = TOPLEVEL::type::Adjust;
 
 YoshimiEditor::YoshimiEditor()
     : UI(600, 400)
     , fSynthesizer(nullptr)
+    , fPlugin(nullptr)
     , fResizeHandle(this)
+    , fEditing(false)
+    , fSyncPending(false)
+    , fSyncAfter(0)
 {
     // Get synth engine instance
-    YoshimiPlugin* fDspInstance = (YoshimiPlugin*)UI::getPluginInstancePointer();
-    fSynthesizer                = &(*fDspInstance->fSynthesizer);
+    fPlugin      = (YoshimiPlugin*)UI::getPluginInstancePointer();
+    fSynthesizer = &(*fPlugin->fSynthesizer);
 
     // hide handle if UI is resizable
     if (isResizable())
         fResizeHandle.hide();
 
     // Fetch initial params from synth side
+    std::memset(&fSnapshot, 0, sizeof(fSnapshot));
+    _fetchSnapshot();
     _fetchParams();
 
-    // Read bank list
+    // Read bank list, once DSP side has it ready. See YoshimiBankLoader.h
+    fPlugin->fBankLoader.wait();
     YoshimiExchange::Bank::getBankEntries(fSynthesizer, fBankEntries);
     fBankCurrent = YoshimiExchange::Bank::getCurrentBank(fSynthesizer);
     fInstCurrent = YoshimiExchange::Bank::getCurrentInstrument(fSynthesizer);
@@ -55,6 +65,17 @@ YoshimiEditor::~YoshimiEditor()
 
 void YoshimiEditor::parameterChanged(uint32_t index, float value)
 {
+    switch (index) {
+        case kParameterMasterVolume:
+            fParams.pVolume = value;
+            break;
+        case kParameterGlobalDetune:
+            fParams.pGlobalDetune = value;
+            break;
+        case kParameterKeyShift:
+            fParams.pKeyShift = value;
+            break;
+    }
 }
 
 void YoshimiEditor::stateChanged(const char* key, const char* value)
@@ -66,6 +87,16 @@ void YoshimiEditor::stateChanged(const char* key, const char* value)
     _fetchParams();
 }
 
+void YoshimiEditor::uiIdle()
+{
+    // Follow engine side (state loads, meters...)
+    if (_fetchSnapshot())
+        repaint();
+
+    if (fSyncPending && _syncStateToHost())
+        fSyncPending = false;
+}
+
 void YoshimiEditor::onImGuiDisplay()
 {
     const float width  = getWidth();
@@ -86,22 +117,50 @@ void YoshimiEditor::onImGuiDisplay()
         }
 #endif
 
+        /*
+         * Master controls are host parameters (see YoshimiAutomation), so that host
+         * records and shows what is done here. Applied by DSP side on its next block.
+         */
         if (ImGui::SliderFloat("Master Volume", &fParams.pVolume, 0.0f, 127.0f)) {
-            // NOTICE: Methods from FLTK UI does not take effects. Use CLI-provided one instead.
-            // YoshimiExchange::MasterUI::send_data(fSynthesizer, 0, MAIN::control::volume, fParams.pVolume, 0, TOPLEVEL::section::main);
+            if (ImGui::IsItemActivated())
+                editParameter(kParameterMasterVolume, true);
 
-            // Interpreted from CLI/CmdInterpreter.cpp:6103
-            YoshimiExchange::sendNormal(fSynthesizer, 0, fParams.pVolume, TOPLEVEL::type::Write, MAIN::control::volume, TOPLEVEL::section::main);
+            setParameterValue(kParameterMasterVolume, fParams.pVolume);
+        }
+
+        if (ImGui::IsItemDeactivated()) {
+            editParameter(kParameterMasterVolume, false);
         }
 
         if (ImGui::SliderFloat("Global Detune", &fParams.pGlobalDetune, 0.0f, 127.0f)) {
-            YoshimiExchange::sendNormal(fSynthesizer, TOPLEVEL::action::lowPrio, fParams.pGlobalDetune, TOPLEVEL::type::Write, MAIN::control::detune, TOPLEVEL::section::main);
+            if (ImGui::IsItemActivated())
+                editParameter(kParameterGlobalDetune, true);
+
+            setParameterValue(kParameterGlobalDetune, fParams.pGlobalDetune);
+        }
+
+        if (ImGui::IsItemDeactivated()) {
+            editParameter(kParameterGlobalDetune, false);
         }
 
         if (ImGui::SliderInt("Key Shift", &fParams.pKeyShift, -36, 36)) {
-            YoshimiExchange::sendNormal(fSynthesizer, TOPLEVEL::action::lowPrio, fParams.pKeyShift, TOPLEVEL::type::Write, MAIN::control::keyShift, TOPLEVEL::section::main);
+            if (ImGui::IsItemActivated())
+                editParameter(kParameterKeyShift, true);
+
+            setParameterValue(kParameterKeyShift, fParams.pKeyShift);
         }
 
+        if (ImGui::IsItemDeactivated()) {
+            editParameter(kParameterKeyShift, false);
+        }
+
+        ImGui::ProgressBar(std::min(fSnapshot.peakL, 1.0f), ImVec2(0.0f, 0.0f), "");
+        ImGui::SameLine();
+        ImGui::Text("Output L");
+        ImGui::ProgressBar(std::min(fSnapshot.peakR, 1.0f), ImVec2(0.0f, 0.0f), "");
+        ImGui::SameLine();
+        ImGui::Text("Output R");
+
         /**
          * Workaround for VST2.
          * Unlike VST3 and CLAP, VST2 version cannot fetch the right current bank
@@ -150,11 +209,12 @@ void YoshimiEditor::onImGuiDisplay()
                         if (ImGui::Selectable(instrument_label, is_selected)) {
                             fInstCurrent = it->first;
 
-                            if (!YoshimiExchange::Bank::fetchData(fSynthesizer, 0, PART::control::enable, 0))
+                            if (!fSnapshot.partEnabled[0])
                                 d_stderr("Active part disabled");
                             else {
                                 // TODO: Specify active part
                                 YoshimiExchange::Bank::switchInstrument(fSynthesizer, fInstCurrent, 0);
+                                _requestStateSync();
                             }
                         }
                     } else {
@@ -171,8 +231,11 @@ void YoshimiEditor::onImGuiDisplay()
         }
 
         if (ImGui::IsItemDeactivated()) {
-            _syncStateToHost();
+            _requestStateSync();
         }
+
+        // Keep what user is dragging away from snapshot updates
+        fEditing = ImGui::IsAnyItemActive();
 #if 0
         if (ImGui::SliderFloat("Gain (dB)", &fGain, -90.0f, 30.0f)) {
             if (ImGui::IsItemActivated())
@@ -192,24 +255,73 @@ void YoshimiEditor::onImGuiDisplay()
 
 // TODO:
 // - Consider moving this to separate file
-// - Implement returns_update() instead of simply fetching values (in case of outdated data)
-//   * Reference: MasterUI::returns_update() (view its call hierachy)
 void YoshimiEditor::_fetchParams()
 {
-    // Some default values can be directly accessed from synth instance
-    fParams.pVolume       = fSynthesizer->Pvolume;
-    fParams.pGlobalDetune = fSynthesizer->microtonal.Pglobalfinedetune;
-    fParams.pKeyShift     = fSynthesizer->Pkeyshift - 64;
+    // Engine values come from the last snapshot published by DSP side, not from synth instance
+    fParams.pVolume       = fSnapshot.volume;
+    fParams.pGlobalDetune = fSnapshot.globalDetune;
+    fParams.pKeyShift     = fSnapshot.keyShift;
+}
+
+/**
+ * Read the latest snapshot. Returns true if anything visible has changed.
+ * On a failed read (DSP side publishing all along), the previous snapshot is kept.
+ */
+bool YoshimiEditor::_fetchSnapshot()
+{
+    YoshimiSnapshotData snapshot;
+
+    if (!fPlugin->fSnapshot.read(snapshot))
+        return false;
+
+    if (std::memcmp(&snapshot, &fSnapshot, sizeof(snapshot)) == 0)
+        return false;
+
+    const bool paramsChanged = snapshot.volume != fSnapshot.volume
+        || snapshot.globalDetune != fSnapshot.globalDetune
+        || snapshot.keyShift != fSnapshot.keyShift;
+
+    fSnapshot = snapshot;
+
+    if (paramsChanged && !fEditing)
+        _fetchParams();
+
+    return true;
+}
+
+/**
+ * Have host get the engine state, once the commands sent so far have taken effect.
+ * Serialising right away would save the engine as it was before them: they are only
+ * handed over at the next run(). See _syncStateToHost(), called from uiIdle().
+ */
+void YoshimiEditor::_requestStateSync()
+{
+    fSyncPending = true;
+    fSyncAfter   = fPlugin->fCommandQueue.pushed();
 }
 
-void YoshimiEditor::_syncStateToHost()
+/**
+ * Sync state to host if the requested commands are applied. Returns false if not yet.
+ */
+bool YoshimiEditor::_syncStateToHost()
 {
-    char* data = nullptr;
-    fSynthesizer->getalldata(&data);
+    // Not handed over to the engine yet (positions wrap around)
+    if ((int32_t)(fSnapshot.commandsApplied - fSyncAfter) < 0)
+        return false;
+
+    // Instruments are loaded by the engine's own thread, after the command is mediated.
+    // TODO: Specify active part
+    if (YoshimiExchange::collect_readData(fSynthesizer, 0, TOPLEVEL::control::partBusy, 0))
+        return false;
+
+    // Limits read while the instrument was loading may not hold for it
+    fPlugin->fCommandQueue.invalidateLimits();
 
-    setState("state", data);
+    // Go through the plugin, so that host gets the same encoding as from YoshimiPlugin::getState()
+    const String state(fPlugin->getState("state"));
 
-    delete data;
+    setState("state", state.buffer());
+    return true;
 }
 
 START_NAMESPACE_DISTRHO
@@ -24,24 +24,37 @@
 
 #include "Exchange/ParamStorage.h"
 #include "Misc/SynthEngine.h"
+#include "YoshimiSnapshot.h"
 
 #include "DistrhoUI.hpp"
 #include "ResizeHandle.hpp"
 
 START_NAMESPACE_DISTRHO
 
+// Forward decls.
+class YoshimiPlugin;
+
 class YoshimiEditor : public UI {
     /*
      * Yoshimi's FLTK UI is managed by synth engine... This is not a good idea.
      * But in the current period, I don't want to touch other parts.
      * So, access to DSP side is required.
      */
-    SynthEngine* fSynthesizer;
+    SynthEngine*   fSynthesizer;
+    YoshimiPlugin* fPlugin;
 
     ResizeHandle fResizeHandle;
 
     YoshimiParamStorage fParams;
 
+    // Last engine snapshot read from DSP side. See YoshimiSnapshot.h
+    YoshimiSnapshotData fSnapshot;
+    bool                fEditing; // Whether user is holding a control
+
+    // State sync to host waiting for the editor's commands to be applied. See _requestStateSync()
+    bool     fSyncPending;
+    uint32_t fSyncAfter; // Command queue position to be reached
+
     BankEntryMap fBankEntries;
     long         fBankCurrent;
     long         fInstCurrent;
@@ -60,6 +73,11 @@ protected:
     // void programLoaded(uint32_t index) override;
     void stateChanged(const char* key, const char* value) override;
 
+    // ----------------------------------------------------------------------------------------------------------------
+    // UI Callbacks
+
+    void uiIdle() override;
+
     // ----------------------------------------------------------------------------------------------------------------
     // Widget Callbacks
 
@@ -70,7 +88,9 @@ private:
     // Internal helpers
 
     void _fetchParams();
-    void _syncStateToHost();
+    bool _fetchSnapshot();
+    void _requestStateSync();
+    bool _syncStateToHost();
 
     DISTRHO_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(YoshimiEditor)
 };
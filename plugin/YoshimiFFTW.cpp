@@ -0,0 +1,32 @@
+/*
+    YoshimiFFTW
+
+    Copyright 2023, AnClark Liu <anclarkliu@outlook.com>
+
+    This file is part of yoshimi, which is free software: you can
+    redistribute it and/or modify it under the terms of the GNU General
+    Public License as published by the Free Software Foundation, either
+    version 2 of the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with yoshimi.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "YoshimiFFTW.h"
+
+#include <fftw3.h>
+#include <mutex>
+
+void YoshimiFFTW::init()
+{
+#if YOSHIMI_FFTW_THREADSAFE
+    static std::once_flag once;
+
+    std::call_once(once, []() { fftwf_make_planner_thread_safe(); });
+#endif
+}
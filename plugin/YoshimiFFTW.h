@@ -0,0 +1,37 @@
+/*
+    YoshimiFFTW
+
+    Copyright 2023, AnClark Liu <anclarkliu@outlook.com>
+
+    This file is part of yoshimi, which is free software: you can
+    redistribute it and/or modify it under the terms of the GNU General
+    Public License as published by the Free Software Foundation, either
+    version 2 of the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with yoshimi.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef YOSHIMI_FFTW_H
+#define YOSHIMI_FFTW_H
+
+/**
+ * Process-wide FFTW setup, shared by all plugin instances loaded by a host.
+ *
+ * FFTW's planner is global and not thread-safe, while hosts create instances (and Yoshimi
+ * builds wavetables) from several threads at once. The first instance makes the planner
+ * thread-safe (needs fftw3f_threads, see YOSHIMI_FFTW_THREADSAFE in CMakeLists.txt).
+ *
+ * No wisdom is kept: Yoshimi's FFTwrapper plans with FFTW_ESTIMATE, which does not use it.
+ */
+namespace YoshimiFFTW {
+    // Call before creating a synth engine
+    void init();
+}
+
+#endif
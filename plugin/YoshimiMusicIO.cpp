@@ -21,14 +21,29 @@
 
 #include "YoshimiMusicIO.h"
 #include "DistrhoPlugin.hpp"
+#include "YoshimiAutomation.h"
+#include "YoshimiBankLoader.h"
 #include "Effects/EffectMgr.h"
 #include "Params/Controller.h"
 
+#include <algorithm>
+#include <fftw3.h>
+
+// Host buffers up to this size are handled without reallocating anything.
+// Larger ones only grow the part scratch buffers, see setBufferSize().
+static constexpr uint32_t kPreallocBufferSize = 4096;
+
 YoshimiMusicIO::YoshimiMusicIO(SynthEngine* synth, uint32_t initSampleRate, uint32_t initBufferSize)
     : MusicIO(synth, new SinglethreadedBeatTracker)
     , _synth(synth)
     , _sampleRate(initSampleRate)
     , _bufferSize(initBufferSize)
+    , _bufferCapacity(0)
+    , _scratchLeft(nullptr)
+    , _scratchRight(nullptr)
+    , _automation(nullptr)
+    , _bankLoader(nullptr)
+    , _deferredMidiCount(0)
 {
     /*
      * Adapted YoshimiLV2Plugin::init() (member function).
@@ -36,9 +51,12 @@ YoshimiMusicIO::YoshimiMusicIO(SynthEngine* synth, uint32_t initSampleRate, uint
      *
      * Notice: In YoshimiLV2Plugin, _bufferSize is assinged in constructor rather than init().
      *         Here we assign it via YoshimiMusicIO's constructor.
+     *
+     * Notice: MusicIO::prepBuffers() is not used, as it sizes the buffers to exactly one host block.
+     *         We preallocate room for the largest block we expect instead.
      */
 
-    if (!prepBuffers()) {
+    if (!_allocBuffers(std::max(initBufferSize, kPreallocBufferSize))) {
         _synth->getRuntime().LogError("Cannot prepare buffers");
         _inited = false;
         return;
@@ -60,6 +78,9 @@ YoshimiMusicIO::YoshimiMusicIO(SynthEngine* synth, uint32_t initSampleRate, uint
 YoshimiMusicIO::~YoshimiMusicIO()
 {
     delete beatTracker;
+
+    fftwf_free(_scratchLeft);
+    fftwf_free(_scratchRight);
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -71,6 +92,13 @@ void YoshimiMusicIO::process(const float** inputs, float** outputs, uint32_t sam
         return;
     }
 
+    // No part scratch (allocation failed), nothing can be rendered
+    if (_bufferCapacity == 0) {
+        for (uint32_t i = 0; i < DISTRHO_PLUGIN_NUM_OUTPUTS; ++i)
+            memset(outputs[i], 0, sample_count * sizeof(float));
+        return;
+    }
+
     /*
      * Our implmentation of LV2 has a problem with envelopes. In general
      * the bigger the buffer size the shorter the envelope, and whichever
@@ -87,12 +115,74 @@ void YoshimiMusicIO::process(const float** inputs, float** outputs, uint32_t sam
     bool                    bpmProvided = false;
     float*                  tmpLeft[NUM_MIDI_PARTS + 1];
     float*                  tmpRight[NUM_MIDI_PARTS + 1];
+    bool                    onScratch[NUM_MIDI_PARTS];
 
-    for (uint32_t i = 0; i < NUM_MIDI_PARTS + 1; ++i) {
-        tmpLeft[i]  = zynLeft[i];
-        tmpRight[i] = zynRight[i];
+    // Per-part output is not used, all parts share one scratch. See _allocBuffers()
+    for (uint32_t i = 0; i < NUM_MIDI_PARTS; ++i) {
+        tmpLeft[i]   = _scratchLeft;
+        tmpRight[i]  = _scratchRight;
+        onScratch[i] = true;
     }
 
+    // Master mix is rendered straight into host buffers, no need to copy it afterwards
+    tmpLeft[NUM_MIDI_PARTS]  = outputs[0];
+    tmpRight[NUM_MIDI_PARTS] = outputs[1];
+
+#if YOSHIMI_PLUGIN_MULTI_OUTPUT
+    /*
+     * Parts sending audio to their own output are rendered straight into their host bus.
+     * Other buses are left to silence, and their parts keep writing to the shared scratch.
+     *
+     * Buses are always cleared first, since the engine may skip a routed part
+     * (e.g. while it is busy loading) without touching its output.
+     *
+     * Routing is sampled once here, before this block's MIDI events and queued commands
+     * are processed. A destination change made within a block takes effect on the next one.
+     */
+    for (uint32_t npart = 0; npart < YOSHIMI_PLUGIN_NUM_PART_BUSES; ++npart) {
+        float* busLeft  = outputs[2 + npart * 2];
+        float* busRight = outputs[3 + npart * 2];
+
+        memset(busLeft, 0, sample_count * sizeof(float));
+        memset(busRight, 0, sample_count * sizeof(float));
+
+        if (_synth->part[npart]->Penabled && (_synth->part[npart]->Paudiodest & 2)) {
+            tmpLeft[npart]   = busLeft;
+            tmpRight[npart]  = busRight;
+            onScratch[npart] = false;
+        }
+    }
+#endif
+
+    /*
+     * Render up to `frames`, and move output pointers past what was rendered.
+     * Scratch content is never read, so parts writing there start over at its beginning
+     * on each call instead of moving along. Calls are capped to its capacity: a host block
+     * larger than announced (some hosts send those) cannot overrun it.
+     */
+    auto masterAudio = [&](uint32_t frames) -> int {
+        frames = std::min(frames, _bufferCapacity);
+
+        for (uint32_t i = 0; i < NUM_MIDI_PARTS; ++i) {
+            if (onScratch[i]) {
+                tmpLeft[i]  = _scratchLeft;
+                tmpRight[i] = _scratchRight;
+            }
+        }
+
+        const int mastered_chunk = _synth->MasterAudio(tmpLeft, tmpRight, frames);
+        for (uint32_t i = 0; i < NUM_MIDI_PARTS + 1; ++i) {
+            tmpLeft[i] += mastered_chunk;
+            tmpRight[i] += mastered_chunk;
+        }
+
+        return mastered_chunk;
+    };
+
+    // Bank and program changes held back while banks were being installed
+    if (_deferredMidiCount > 0 && _bankLoader->isReady())
+        _replayDeferredMidi();
+
     for (uint32_t i = 0; i < midi_event_count; i++) {
         DISTRHO::MidiEvent event = midi_events[i]; // NOTICE: DPF's MidiEvent is never null
 
@@ -116,13 +206,8 @@ void YoshimiMusicIO::process(const float** inputs, float** outputs, uint32_t sam
             while (to_process - mastered > 0) {
                 float bpmInc = (float)(processed + mastered - beatsAt) * beats.bpm / (synth->samplerate_f * 60.f);
                 synth->setBeatValues(beats.songBeat + bpmInc, beats.monotonicBeat + bpmInc, beats.bpm);
-                int mastered_chunk = _synth->MasterAudio(tmpLeft, tmpRight, to_process - mastered);
-                for (uint32_t i = 0; i < NUM_MIDI_PARTS + 1; ++i) {
-                    tmpLeft[i] += mastered_chunk;
-                    tmpRight[i] += mastered_chunk;
-                }
-
-                mastered += mastered_chunk;
+                _tickAutomation(to_process - mastered);
+                mastered += masterAudio(to_process - mastered);
             }
             processed += to_process;
         }
@@ -140,12 +225,8 @@ void YoshimiMusicIO::process(const float** inputs, float** outputs, uint32_t sam
         while (to_process - mastered > 0) {
             float bpmInc = (float)(processed + mastered - beatsAt) * beats.bpm / (synth->samplerate_f * 60.f);
             synth->setBeatValues(beats.songBeat + bpmInc, beats.monotonicBeat + bpmInc, beats.bpm);
-            int mastered_chunk = _synth->MasterAudio(tmpLeft, tmpRight, to_process - mastered);
-            for (uint32_t i = 0; i < NUM_MIDI_PARTS + 1; ++i) {
-                tmpLeft[i] += mastered_chunk;
-                tmpRight[i] += mastered_chunk;
-            }
-            mastered += mastered_chunk;
+            _tickAutomation(to_process - mastered);
+            mastered += masterAudio(to_process - mastered);
         }
         processed += to_process;
     }
@@ -183,21 +264,59 @@ void YoshimiMusicIO::process(const float** inputs, float** outputs, uint32_t sam
         aSeq->atom.size = sizeof(LV2_Atom_Sequence_Body);
     }
 #endif
+}
 
-    /*
-     * Currently only 2-channel edition is supported.
-     */
-    memcpy(outputs[0], zynLeft[NUM_MIDI_PARTS], sample_count * sizeof(float));
-    memcpy(outputs[1], zynRight[NUM_MIDI_PARTS], sample_count * sizeof(float));
+void YoshimiMusicIO::_tickAutomation(uint32_t to_process)
+{
+    // MasterAudio() renders at most one engine buffer per call, and process() at most one scratch
+    if (_automation)
+        _automation->tick(_synth, std::min({ to_process, (uint32_t)_synth->buffersize, _bufferCapacity }));
 }
 
 void YoshimiMusicIO::processMidiMessage(const uint8_t* msg)
 {
     // NOTICE: _bFreeWheel will be zero in LV2. Simply bypass it as I don't know how to implement this.
     bool in_place = false; // _bFreeWheel ? ((*_bFreeWheel == 0) ? false : true) : false;
+
+    if (_deferBankMessage(msg))
+        return;
+
     setMidi(msg[0], msg[1], msg[2], in_place);
 }
 
+// ----------------------------------------------------------------------------------------------------------------
+// Banks
+
+/**
+ * Hold back bank select (CC 0 / 32) and program change while banks are being installed
+ * (see YoshimiBankLoader), since they would reach into the bank under the loader thread.
+ * Returns true if message was taken. Past kMaxDeferredMidi messages, later ones are dropped.
+ */
+bool YoshimiMusicIO::_deferBankMessage(const uint8_t* msg)
+{
+    if (_bankLoader == nullptr || _bankLoader->isReady())
+        return false;
+
+    const uint8_t status = msg[0] & 0xF0;
+    if (status != 0xC0 && !(status == 0xB0 && (msg[1] == 0 || msg[1] == 32)))
+        return false;
+
+    if (_deferredMidiCount < kMaxDeferredMidi) {
+        memcpy(_deferredMidi[_deferredMidiCount], msg, 3);
+        ++_deferredMidiCount;
+    }
+
+    return true;
+}
+
+void YoshimiMusicIO::_replayDeferredMidi()
+{
+    for (uint32_t i = 0; i < _deferredMidiCount; ++i)
+        setMidi(_deferredMidi[i][0], _deferredMidi[i][1], _deferredMidi[i][2], false);
+
+    _deferredMidiCount = 0;
+}
+
 // ----------------------------------------------------------------------------------------------------------------
 // Access from plugin interface
 
@@ -223,24 +342,31 @@ void YoshimiMusicIO::setSamplerate(uint32_t newSampleRate)
 void YoshimiMusicIO::setBufferSize(uint32_t newBufferSize)
 {
     /*
-     * Must reinit synthesizer on every buffer size changes.
-     * Otherwise Yoshimi will behave unexpectedly on VST3 and CLAP:
-     *   - Crash when destroying Parts (during destructor of SynthEngine)!
-     *   - Generate wrong samples (REAPER will automute the track)!
+     * Buffer size changes no longer reinit the synth engine.
+     *
+     * The engine keeps the buffer size it was initialised with: MasterAudio() renders
+     * at most that many frames per call, and process() already loops over a host block
+     * in such chunks. The part scratch buffers are reused on each of those calls, and calls
+     * are capped to their capacity, so a host block of any size fits. Overrunning them is what used
+     * to crash VST3 and CLAP hosts (in Part destructors) and make REAPER automute the track.
      *
-     * It was hard to find out why that crash happens, until it occured to me that buffer size
-     * was not handled properly in my plugin.
+     * Formerly the engine was reinited here, which destroyed all parts and effects
+     * and forced the caller to back up and restore the whole state (rebuilding every
+     * PADsynth table on the way).
      */
 
     _bufferSize = newBufferSize;
 
-    // Deinit synth parts first. This prevents unexpected memory consumptions
-    _deinitSynthParts();
+    if (_bufferSize <= _bufferCapacity) {
+        d_stderr("Buffer size changed to %d", _bufferSize);
+        return;
+    }
 
-    if (!_synth->Init(_sampleRate, _bufferSize)) {
-        _synth->getRuntime().LogError("Cannot reinit synth engine on buffer size change");
+    // Host block is larger than what we have preallocated. Only the MusicIO buffers need to grow.
+    if (!_allocBuffers(_bufferSize)) {
+        _synth->getRuntime().LogError("Cannot grow buffers on buffer size change");
     } else {
-        d_stderr("Buffer size changed to %d", _bufferSize);
+        d_stderr("Buffer size changed to %d, buffers grown", _bufferSize);
     }
 }
 
@@ -285,3 +411,43 @@ void YoshimiMusicIO::_deinitSynthParts()
         _synth->ctl = NULL;
     }
 }
+
+// ----------------------------------------------------------------------------------------------------------------
+// Buffer management
+
+bool YoshimiMusicIO::_allocBuffers(uint32_t capacity)
+{
+    /*
+     * (Re)allocate part scratch buffers with room for `capacity` frames.
+     *
+     * MasterAudio() wants an output pair for every part, but the host only gets the main mix
+     * (rendered straight into host buffers), plus on multi-output variant the buses of routed parts
+     * (rendered straight into their bus). What parts write to their own pair is never read.
+     * So instead of a zynLeft / zynRight pair for each of NUM_MIDI_PARTS + 1 slots (2 MB at 4096 frames),
+     * all parts write to one shared pair. Memory no longer scales with the number of parts.
+     *
+     * zynLeft / zynRight are left unallocated, so MusicIO's destructor has nothing to free.
+     */
+
+    fftwf_free(_scratchLeft);
+    fftwf_free(_scratchRight);
+
+    _scratchLeft  = (float*)fftwf_malloc(capacity * sizeof(float));
+    _scratchRight = (float*)fftwf_malloc(capacity * sizeof(float));
+
+    if (!_scratchLeft || !_scratchRight) {
+        // Don't keep half of a pair around
+        fftwf_free(_scratchLeft);
+        fftwf_free(_scratchRight);
+        _scratchLeft    = nullptr;
+        _scratchRight   = nullptr;
+        _bufferCapacity = 0;
+        return false;
+    }
+
+    memset(_scratchLeft, 0, capacity * sizeof(float));
+    memset(_scratchRight, 0, capacity * sizeof(float));
+
+    _bufferCapacity = capacity;
+    return true;
+}
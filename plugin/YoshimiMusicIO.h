@@ -28,16 +28,32 @@
 namespace DISTRHO {
     struct MidiEvent;
 }
+class YoshimiAutomation;
+class YoshimiBankLoader;
 
 class YoshimiMusicIO : public MusicIO {
 private:
     SynthEngine* _synth;
     uint32_t     _sampleRate;
     uint32_t     _bufferSize;
+    uint32_t     _bufferCapacity; // Frames allocated for each part scratch buffer
     bool         _inited;
 
     float* _bFreeWheel; // TODO: How to implement this?
 
+    // Output of all parts, shared. See _allocBuffers()
+    float* _scratchLeft;
+    float* _scratchRight;
+
+    YoshimiAutomation* _automation;
+
+    // Bank / program changes arriving before banks are installed, replayed afterwards
+    static constexpr uint32_t kMaxDeferredMidi = 32;
+
+    const YoshimiBankLoader* _bankLoader;
+    uint8_t                  _deferredMidi[kMaxDeferredMidi][3];
+    uint32_t                 _deferredMidiCount;
+
 public:
     YoshimiMusicIO(SynthEngine* synth, uint32_t initSampleRate, uint32_t initBufferSize);
     ~YoshimiMusicIO();
@@ -47,6 +63,8 @@ public:
     bool hasInited() { return _inited; }
     void setSamplerate(uint32_t newSampleRate);
     void setBufferSize(uint32_t newBufferSize);
+    void setAutomation(YoshimiAutomation* automation) { _automation = automation; }
+    void setBankLoader(const YoshimiBankLoader* bankLoader) { _bankLoader = bankLoader; }
 
     // ----------------------------------------------------------------------------------------------------------------
     // Virtual methods from MusicIO
@@ -71,9 +89,22 @@ public:
     void processMidiMessage(const uint8_t* msg);
 
 private:
+    // ----------------------------------------------------------------------------------------------------------------
+    // Parameters
+    void _tickAutomation(uint32_t to_process);
+
+    // ----------------------------------------------------------------------------------------------------------------
+    // Banks
+    bool _deferBankMessage(const uint8_t* msg);
+    void _replayDeferredMidi();
+
     // ----------------------------------------------------------------------------------------------------------------
     // Workarounds
     void _deinitSynthParts();
+
+    // ----------------------------------------------------------------------------------------------------------------
+    // Buffer management
+    bool _allocBuffers(uint32_t capacity);
 };
 
 #endif
@@ -20,16 +20,35 @@
 */
 
 #include "YoshimiPlugin.h"
+#include "YoshimiDenormals.h"
+#include "YoshimiFFTW.h"
 #include "YoshimiMusicIO.h"
+#include "YoshimiRtCheck.h"
+#include "YoshimiState.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 YoshimiPlugin::YoshimiPlugin()
-    : Plugin(0, 0, 1) // parameters, programs, states
+    : Plugin(kParameterCount, 0, 1) // parameters, programs, states
+    , fPendingSampleRate(0)
 {
+    // Must be ready before the synth engine plans its FFTs
+    YoshimiFFTW::init();
+
+    // No-op unless built with YoshimiRtCheck
+    YoshimiRtCheck::init();
+
     /*
      * Initialize synthesizer and MusicIO.
      */
     std::list<string> dummy;
+#if YOSHIMI_PLUGIN_MULTI_OUTPUT
+    fSynthesizer = std::make_unique<SynthEngine>(dummy, LV2PluginTypeMulti); // Set as multi-output plugin
+#else
     fSynthesizer = std::make_unique<SynthEngine>(dummy, LV2PluginTypeSingle); // Set as single-output plugin
+#endif
     fSynthInited = true;
 
     fMusicIo       = std::make_unique<YoshimiMusicIO>(&(*fSynthesizer), (uint32_t)getSampleRate(), (uint32_t)getBufferSize());
@@ -54,15 +73,7 @@ YoshimiPlugin::YoshimiPlugin()
         return;
     }
 
-    if (fMusicIo->hasInited()) {
-        /*
-         * Perform further global initialisation.
-         * For stand-alone the equivalent init happens in main(),
-         * after mainCreateNewInstance() returned successfully.
-         */
-        fSynthesizer->installBanks();
-        fSynthesizer->loadHistory();
-    } else {
+    if (!fMusicIo->hasInited()) {
         fSynthesizer->getRuntime().LogError("Failed to create Yoshimi DPF plugin");
         fSynthesizer.reset(); // delete synth instance
         fMusicIo.reset();
@@ -72,10 +83,31 @@ YoshimiPlugin::YoshimiPlugin()
         return;
     }
 
+    /*
+     * Let host automation take over from engine's current values.
+     */
+    fAutomation.syncFromEngine(fSynthesizer.get());
+    fMusicIo->setAutomation(&fAutomation);
+
+    YoshimiExchange::registerCommandQueue(fSynthesizer.get(), &fCommandQueue);
+
+    /*
+     * Give editor something to read before the first run().
+     */
+    std::memset(&fSnapshotData, 0, sizeof(fSnapshotData));
+    _publishSnapshot(nullptr, 0);
+
     /*
      * Initialize default state value.
      */
-    defaultState = _getState();
+    defaultState = String(_getState(), false);
+
+    /*
+     * Install banks and history in background. See YoshimiBankLoader.h
+     * Default state above is taken from the pristine engine, before the loader thread owns the bank.
+     */
+    fMusicIo->setBankLoader(&fBankLoader);
+    fBankLoader.start(fSynthesizer.get());
 
     fSynthesizer->getRuntime().Log("Now Yoshimi is ready!");
 }
@@ -90,6 +122,11 @@ YoshimiPlugin::~YoshimiPlugin()
     //{
     //     fMusicIO->getProgram(flatbankprgs.size() + 1);
     // }
+    YoshimiExchange::unregisterCommandQueue(fSynthesizer.get());
+
+    // Engine must not go away under a bank scan
+    fBankLoader.wait();
+
     fSynthesizer->getRuntime().runSynth = false;
     fSynthesizer->getRuntime().Log("EXIT plugin");
     fSynthesizer->getRuntime().Log("Goodbye - Play again soon?");
@@ -97,6 +134,10 @@ YoshimiPlugin::~YoshimiPlugin()
     /*
      * fSynthesizer and fMusicIo will be automatically cleaned up by unique_ptr.
      */
+    fMusicIo.reset();
+    fSynthesizer.reset();
+
+    YoshimiRtCheck::report();
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -114,11 +155,46 @@ void YoshimiPlugin::initState(uint32_t index, State& state)
     state.defaultValue = defaultState;
 }
 
+void YoshimiPlugin::initAudioPort(bool input, uint32_t index, AudioPort& port)
+{
+    /*
+     * Outputs 0 and 1 are the main mix.
+     * On multi-output variant, every following pair is the stereo bus of a part.
+     * See: YoshimiMusicIO::process().
+     */
+
+    if (input || index < 2) {
+        port.groupId = kPortGroupStereo;
+        Plugin::initAudioPort(input, index, port);
+        return;
+    }
+
+    const uint32_t part  = (index - 2) / 2;
+    const bool     right = (index - 2) % 2;
+
+    char name[32], symbol[32];
+    snprintf(name, sizeof(name), "Part %u %s", part + 1, right ? "Right" : "Left");
+    snprintf(symbol, sizeof(symbol), "part%u_out_%s", part + 1, right ? "r" : "l");
+
+    port.name    = name;
+    port.symbol  = symbol;
+    port.groupId = part;
+}
+
+void YoshimiPlugin::initPortGroup(uint32_t groupId, PortGroup& portGroup)
+{
+    // Only part buses use custom groups. Their IDs are the part numbers.
+    char name[32], symbol[32];
+    snprintf(name, sizeof(name), "Part %u", groupId + 1);
+    snprintf(symbol, sizeof(symbol), "part%u", groupId + 1);
+
+    portGroup.name   = name;
+    portGroup.symbol = symbol;
+}
+
 void YoshimiPlugin::initParameter(uint32_t index, Parameter& parameter)
 {
-    // Yoshimi does not use parameters
-    (void)index;
-    (void)parameter;
+    YoshimiAutomation::initParameter(index, parameter);
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -129,7 +205,20 @@ String YoshimiPlugin::getState(const char* key) const
     YOSHIMI_INIT_SAFE_CHECK(String())
 
     if (strcmp(key, "state") == 0) {
-        return String(_getState(), false);
+        // Not applied yet, see sampleRateChanged()
+        if (fPendingSampleRate != 0 && fPendingState.isNotEmpty())
+            return fPendingState;
+
+        // Engine's bank is not ours until banks are installed
+        fBankLoader.wait();
+
+        /*
+         * Always serialised. The engine has no change flag that every write path keeps up to date
+         * (needsSaving is a plain bool, set from several threads), and a stale copy would be saved silently.
+         */
+        const String state(_getState(), false);
+
+        return state;
     }
 
     return String();
@@ -140,21 +229,72 @@ void YoshimiPlugin::setState(const char* key, const char* value)
     YOSHIMI_INIT_SAFE_CHECK()
 
     if (strcmp(key, "state") == 0) {
-        fSynthesizer->putalldata(value, sizeof(value));
+        // Parsing now would build all PADsynth tables for a sample rate that is about to change.
+        // Keep it until the engine runs at the new rate, see _applyPendingSampleRate().
+        if (fPendingSampleRate != 0) {
+            fPendingState = value;
+            return;
+        }
+
+        fBankLoader.wait();
+
+        char*  decoded = nullptr;
+        size_t xmlSize = 0;
+
+        if (YoshimiState::isEncoded(value)) {
+            decoded = YoshimiState::decode(value, &xmlSize);
+
+            if (!decoded) {
+                fSynthesizer->getRuntime().LogError("Cannot decode plugin state");
+                return;
+            }
+        } else {
+            // Plain XML, saved by older versions or imported from elsewhere
+            xmlSize = strlen(value);
+        }
+
+        const char* xml = decoded ? decoded : value;
+
+        /*
+         * Skip reloading what the engine already holds. This happens when a host restores
+         * a project that is unchanged, and on every state sync from our own editor.
+         * Checked against the engine itself: serialising costs far less than a reload
+         * (which rebuilds every part), and no change can be missed this way.
+         */
+        char* current = nullptr;
+        fSynthesizer->getalldata(&current);
+
+        const bool unchanged = current && strlen(current) == xmlSize && memcmp(current, xml, xmlSize) == 0;
+        free(current);
+
+        if (unchanged) {
+            free(decoded);
+            return;
+        }
+
+        fSynthesizer->putalldata(xml, xmlSize);
+        free(decoded);
+
+        // Parameters follow the loaded state
+        fAutomation.syncFromEngine(fSynthesizer.get());
+
+        // Editor's cached control limits may not hold for the new parts and effects
+        fCommandQueue.invalidateLimits();
+
+        // Engine now matches this state
+        fSynthesizer->setNeedsSaving(false);
     }
 }
 
 float YoshimiPlugin::getParameterValue(uint32_t index) const
 {
-    // Yoshimi does not use parameters
-    return index;
+    return fAutomation.getValue(index);
 }
 
 void YoshimiPlugin::setParameterValue(uint32_t index, float value)
 {
-    // Yoshimi does not use parameters
-    (void)index;
-    (void)value;
+    // Applied by audio thread, see YoshimiMusicIO::process()
+    fAutomation.setValue(index, value);
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -164,6 +304,8 @@ void YoshimiPlugin::activate()
 {
     YOSHIMI_INIT_SAFE_CHECK()
 
+    _applyPendingSampleRate();
+
     fMusicIo->Start();
 }
 
@@ -172,13 +314,26 @@ void YoshimiPlugin::deactivate()
     YOSHIMI_INIT_SAFE_CHECK()
 
     fMusicIo->Close();
+
+    YoshimiRtCheck::report();
 }
 
 void YoshimiPlugin::run(const float** inputs, float** outputs, uint32_t frames, const MidiEvent* midiEvents, uint32_t midiEventCount)
 {
     YOSHIMI_INIT_SAFE_CHECK()
 
+    // Keep decaying filter states out of denormal range. See YoshimiDenormals.h
+    const ScopedDenormalsDisable denormalsDisable;
+
+    // Nothing in here may allocate, lock or do file I/O. See YoshimiRtCheck.h
+    const YoshimiRtCheck::ScopedRealtime realtime;
+
+    // Editor's pending commands, mediated by the engine within this block
+    fCommandQueue.flush(fSynthesizer.get());
+
     fMusicIo->process(inputs, outputs, frames, midiEvents, midiEventCount);
+
+    _publishSnapshot(outputs, frames);
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -189,18 +344,14 @@ void YoshimiPlugin::bufferSizeChanged(uint32_t newBufferSize)
     /*
      * Buffer size changes MUST be handled properly!
      * See: YoshimiMusicIO::setBufferSize().
+     *
+     * No state backup is needed here: the synth engine is kept alive, only
+     * MusicIO buffers may be resized.
      */
 
     YOSHIMI_INIT_SAFE_CHECK()
 
-    // Back up all states
-    const char* state_backup(_getState());
-
-    // Reinit synth engine with new buffer size
     fMusicIo->setBufferSize(newBufferSize);
-
-    // Restore states
-    setState("state", state_backup);
 }
 
 void YoshimiPlugin::sampleRateChanged(double newSampleRate)
@@ -208,18 +359,19 @@ void YoshimiPlugin::sampleRateChanged(double newSampleRate)
     /*
      * Sample rate changes MUST be handled properly!
      * See: YoshimiMusicIO::setSampleRate().
+     *
+     * Reiniting the engine is expensive (every PADsynth table and oscillator spectrum is rebuilt),
+     * so it is deferred to the next activate(). DPF always deactivates the plugin around this
+     * callback, so nothing is rendered at the stale rate meanwhile. This way:
+     *   - Several changes before activation cost only one reinit.
+     *   - Going back to the rate the engine already runs at costs nothing.
+     *   - A state set by the host in between (typical on project load) is parsed only once,
+     *     at the new rate, instead of once before and once after the reinit.
      */
 
     YOSHIMI_INIT_SAFE_CHECK()
 
-    // Back up all states
-    const char* state_backup(_getState());
-
-    // Reinit synth engine with new sample rate
-    fMusicIo->setSamplerate(newSampleRate);
-
-    // Restore states
-    setState("state", state_backup);
+    fPendingSampleRate = (uint32_t)newSampleRate;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -230,7 +382,85 @@ char* YoshimiPlugin::_getState() const
     char* data = nullptr;
     fSynthesizer->getalldata(&data);
 
+#if YOSHIMI_COMPACT_STATE
+    /*
+     * Host-facing state is the compact encoding of the XML, see YoshimiState.h.
+     * XML itself stays the format for import / export.
+     */
+    char* state = YoshimiState::encode(data);
+    if (!state) {
+        fSynthesizer->getRuntime().LogError("Cannot encode plugin state, saving plain XML");
+        return data;
+    }
+
+    free(data);
+    return state;
+#else
+    // Plain XML, loadable by every release
     return data;
+#endif
+}
+
+void YoshimiPlugin::_applyPendingSampleRate()
+{
+    if (fPendingSampleRate == 0)
+        return;
+
+    const uint32_t newSampleRate = fPendingSampleRate;
+    fPendingSampleRate           = 0;
+
+    if (newSampleRate != fMusicIo->getSamplerate()) {
+        // Back up all states, unless host has already given us the one to restore
+        String state_backup(fPendingState.isNotEmpty() ? fPendingState : getState("state"));
+        fPendingState.clear();
+
+        // Reinit synth engine with new sample rate. Engine is empty afterwards.
+        fMusicIo->setSamplerate(newSampleRate);
+
+        // Restore states
+        setState("state", state_backup);
+    } else if (fPendingState.isNotEmpty()) {
+        // Engine already runs at this rate, just load what host has set
+        String state(fPendingState);
+        fPendingState.clear();
+
+        setState("state", state);
+    }
+}
+
+void YoshimiPlugin::_publishSnapshot(float** outputs, uint32_t frames)
+{
+    YoshimiSnapshotData& data = fSnapshotData;
+
+    data.volume       = fSynthesizer->Pvolume;
+    data.globalDetune = fSynthesizer->microtonal.Pglobalfinedetune;
+    data.keyShift     = fSynthesizer->Pkeyshift - 64;
+
+    for (int npart = 0; npart < NUM_MIDI_PARTS; ++npart)
+        data.partEnabled[npart] = fSynthesizer->part[npart]->Penabled;
+
+    // Flushed at the beginning of this block, so mediated by now
+    data.commandsApplied = fCommandQueue.flushed();
+
+    /*
+     * Meters hold the block peak, then fall back (by 1/e every 300 ms),
+     * so that the editor does not miss peaks between its frames.
+     */
+    if (outputs != nullptr) {
+        float peakL = 0.0f, peakR = 0.0f;
+
+        for (uint32_t i = 0; i < frames; ++i) {
+            peakL = std::max(peakL, std::fabs(outputs[0][i]));
+            peakR = std::max(peakR, std::fabs(outputs[1][i]));
+        }
+
+        const float fall = std::exp(-(float)frames / (0.3f * (float)getSampleRate()));
+
+        data.peakL = std::max(peakL, data.peakL * fall);
+        data.peakR = std::max(peakR, data.peakR * fall);
+    }
+
+    fSnapshot.publish(data);
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -23,6 +23,10 @@
 #define YOSHIMI_PLUGIN_H
 
 #include "Misc/SynthEngine.h"
+#include "YoshimiAutomation.h"
+#include "YoshimiBankLoader.h"
+#include "YoshimiSnapshot.h"
+#include "Exchange/CommandQueue.hpp"
 
 #include "DistrhoPlugin.hpp"
 #include <memory>
@@ -37,8 +41,26 @@ class YoshimiPlugin : public Plugin {
     std::unique_ptr<YoshimiMusicIO> fMusicIo;
     bool                            fSynthInited, fMusicIoInited;
 
+    YoshimiAutomation fAutomation;
+
+    // Background bank scan, waited for by anything that needs the bank (state, editor)
+    mutable YoshimiBankLoader fBankLoader;
+
+    // Editor's commands, handed over to the engine at the beginning of each run()
+    YoshimiExchange::CommandQueue fCommandQueue;
+
+    // What the editor reads instead of engine, published at the end of each run()
+    YoshimiSnapshot     fSnapshot;
+    YoshimiSnapshotData fSnapshotData; // Audio thread only
+
     String defaultState;
 
+    // Sample rate change deferred to the next activate() (0 if none),
+    // and a state set by the host in the meantime.
+    uint32_t fPendingSampleRate;
+    String   fPendingState;
+
+
     // Let the UI side access DSP side (mainly for synth instance)
     friend class YoshimiEditor;
 
@@ -56,7 +78,11 @@ protected:
     */
     const char* getLabel() const noexcept override
     {
+#if YOSHIMI_PLUGIN_MULTI_OUTPUT
+        return "YoshimiMulti";
+#else
         return "Yoshimi";
+#endif
     }
 
     /**
@@ -101,12 +127,18 @@ protected:
     */
     int64_t getUniqueId() const noexcept override
     {
+#if YOSHIMI_PLUGIN_MULTI_OUTPUT
+        return d_cconst('y', 'o', 's', 'M');
+#else
         return d_cconst('y', 'o', 's', 'm');
+#endif
     }
 
     // ----------------------------------------------------------------------------------------------------------------
     // Init
 
+    void initAudioPort(bool input, uint32_t index, AudioPort& port) override;
+    void initPortGroup(uint32_t groupId, PortGroup& portGroup) override;
     void initParameter(uint32_t index, Parameter& parameter) override;
     void initState(uint32_t index, State& state) override;
 
@@ -138,6 +170,8 @@ private:
     // Internal helpers
 
     char* _getState() const;
+    void  _applyPendingSampleRate();
+    void  _publishSnapshot(float** outputs, uint32_t frames);
 
     // ----------------------------------------------------------------------------------------------------------------
 
@@ -0,0 +1,370 @@
+/*
+    YoshimiRtCheck
+
+    Copyright 2023, AnClark Liu <anclarkliu@outlook.com>
+
+    This file is part of yoshimi, which is free software: you can
+    redistribute it and/or modify it under the terms of the GNU General
+    Public License as published by the Free Software Foundation, either
+    version 2 of the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with yoshimi.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "YoshimiRtCheck.h"
+
+#if YOSHIMI_RT_CHECK
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <mutex>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+
+// ----------------------------------------------------------------------------------------------------------------
+// Violation log
+
+namespace {
+    constexpr unsigned int kMaxViolations = 256;
+    constexpr int          kMaxFrames     = 24;
+
+    struct Violation {
+        const char*       what;
+        int               frames;
+        void*             stack[kMaxFrames];
+        std::atomic<bool> ready;
+    };
+
+    Violation                 violations[kMaxViolations];
+    std::atomic<unsigned int> violationCount(0); // May exceed kMaxViolations, extra ones are only counted
+    bool                      abortOnViolation = false;
+
+    std::mutex   reportMutex;
+    unsigned int reported = 0;
+
+    /*
+     * Static TLS: a dlopen()-ed library otherwise gets its TLS block allocated lazily,
+     * with malloc, on first access from each thread. That is, from inside our malloc wrapper.
+     */
+    __attribute__((tls_model("initial-exec"))) thread_local int  realtimeDepth = 0;
+    __attribute__((tls_model("initial-exec"))) thread_local bool recording     = false;
+}
+
+static void _violation(const char* what)
+{
+    if (realtimeDepth == 0 || recording)
+        return;
+
+    recording = true;
+
+    const unsigned int index = violationCount.fetch_add(1, std::memory_order_relaxed);
+    if (index < kMaxViolations) {
+        Violation& violation = violations[index];
+
+        violation.what   = what;
+        violation.frames = backtrace(violation.stack, kMaxFrames);
+        violation.ready.store(true, std::memory_order_release);
+    }
+
+    if (abortOnViolation) {
+        static const char message[] = "Yoshimi: real-time safety violation, aborting\n";
+        const ssize_t written = ::write(STDERR_FILENO, message, sizeof(message) - 1);
+        (void)written;
+        if (index < kMaxViolations)
+            backtrace_symbols_fd(violations[index].stack, violations[index].frames, STDERR_FILENO);
+        abort();
+    }
+
+    recording = false;
+}
+
+void YoshimiRtCheck::init()
+{
+    /*
+     * backtrace() loads libgcc and allocates on its first call. Get that done here,
+     * not on the audio thread in the middle of recording.
+     */
+    void* dummy[1];
+    backtrace(dummy, 1);
+
+    const char* env  = getenv("YOSHIMI_RT_CHECK_ABORT");
+    abortOnViolation = env && env[0] == '1';
+}
+
+unsigned int YoshimiRtCheck::report()
+{
+    std::lock_guard<std::mutex> lock(reportMutex);
+
+    const unsigned int count = violationCount.load(std::memory_order_relaxed);
+
+    for (; reported < count && reported < kMaxViolations; ++reported) {
+        Violation& violation = violations[reported];
+
+        // Still being recorded. Leave it for the next report.
+        if (!violation.ready.load(std::memory_order_acquire))
+            break;
+
+        fprintf(stderr, "Yoshimi: real-time safety violation #%u: %s in run()\n", reported + 1, violation.what);
+        fflush(stderr);
+        backtrace_symbols_fd(violation.stack, violation.frames, STDERR_FILENO);
+    }
+
+    if (count > kMaxViolations)
+        fprintf(stderr, "Yoshimi: %u more real-time safety violations not recorded\n", count - kMaxViolations);
+
+    return count;
+}
+
+void YoshimiRtCheck::enterRealtime()
+{
+    ++realtimeDepth;
+}
+
+void YoshimiRtCheck::leaveRealtime()
+{
+    --realtimeDepth;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+// Wrappers, see -Wl,--wrap in CMakeLists.txt
+// Everything linked into the plugin calls __wrap_X instead of X, and __real_X is the original.
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void  __real_free(void* ptr);
+int   __real_posix_memalign(void** ptr, size_t alignment, size_t size);
+
+void* __real__Znwm(size_t size);
+void* __real__Znam(size_t size);
+void  __real__ZdlPv(void* ptr);
+void  __real__ZdaPv(void* ptr);
+void  __real__ZdlPvm(void* ptr, size_t size);
+void  __real__ZdaPvm(void* ptr, size_t size);
+
+int __real_pthread_mutex_lock(pthread_mutex_t* mutex);
+int __real_sem_wait(sem_t* sem);
+int __real_sem_timedwait(sem_t* sem, const struct timespec* timeout);
+
+int     __real_open(const char* path, int flags, ...);
+ssize_t __real_read(int fd, void* buffer, size_t size);
+ssize_t __real_write(int fd, const void* buffer, size_t size);
+FILE*   __real_fopen(const char* path, const char* mode);
+size_t  __real_fread(void* buffer, size_t size, size_t count, FILE* file);
+size_t  __real_fwrite(const void* buffer, size_t size, size_t count, FILE* file);
+
+int     __real_open64(const char* path, int flags, ...);
+FILE*   __real_fopen64(const char* path, const char* mode);
+int     __real___open_2(const char* path, int flags);
+int     __real___open64_2(const char* path, int flags);
+ssize_t __real___read_chk(int fd, void* buffer, size_t size, size_t bufferSize);
+size_t  __real___fread_chk(void* buffer, size_t bufferSize, size_t size, size_t count, FILE* file);
+
+// Allocator
+
+void* __wrap_malloc(size_t size)
+{
+    _violation("malloc");
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    _violation("calloc");
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    _violation("realloc");
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void* ptr)
+{
+    if (ptr)
+        _violation("free");
+    __real_free(ptr);
+}
+
+int __wrap_posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    _violation("posix_memalign");
+    return __real_posix_memalign(ptr, alignment, size);
+}
+
+void* __wrap__Znwm(size_t size)
+{
+    _violation("operator new");
+    return __real__Znwm(size);
+}
+
+void* __wrap__Znam(size_t size)
+{
+    _violation("operator new[]");
+    return __real__Znam(size);
+}
+
+void __wrap__ZdlPv(void* ptr)
+{
+    if (ptr)
+        _violation("operator delete");
+    __real__ZdlPv(ptr);
+}
+
+void __wrap__ZdaPv(void* ptr)
+{
+    if (ptr)
+        _violation("operator delete[]");
+    __real__ZdaPv(ptr);
+}
+
+void __wrap__ZdlPvm(void* ptr, size_t size)
+{
+    if (ptr)
+        _violation("operator delete");
+    __real__ZdlPvm(ptr, size);
+}
+
+void __wrap__ZdaPvm(void* ptr, size_t size)
+{
+    if (ptr)
+        _violation("operator delete[]");
+    __real__ZdaPvm(ptr, size);
+}
+
+// Locks
+
+int __wrap_pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+    _violation("pthread_mutex_lock");
+    return __real_pthread_mutex_lock(mutex);
+}
+
+int __wrap_sem_wait(sem_t* sem)
+{
+    _violation("sem_wait");
+    return __real_sem_wait(sem);
+}
+
+int __wrap_sem_timedwait(sem_t* sem, const struct timespec* timeout)
+{
+    _violation("sem_timedwait");
+    return __real_sem_timedwait(sem, timeout);
+}
+
+// File I/O
+
+static bool _openHasMode(int flags)
+{
+#ifdef O_TMPFILE
+    return (flags & O_CREAT) || ((flags & O_TMPFILE) == O_TMPFILE);
+#else
+    return flags & O_CREAT;
+#endif
+}
+
+int __wrap_open(const char* path, int flags, ...)
+{
+    _violation("open");
+
+    mode_t mode = 0;
+    if (_openHasMode(flags)) {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
+    }
+
+    return __real_open(path, flags, mode);
+}
+
+int __wrap_open64(const char* path, int flags, ...)
+{
+    _violation("open64");
+
+    mode_t mode = 0;
+    if (_openHasMode(flags)) {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
+    }
+
+    return __real_open64(path, flags, mode);
+}
+
+int __wrap___open_2(const char* path, int flags)
+{
+    _violation("open");
+    return __real___open_2(path, flags);
+}
+
+int __wrap___open64_2(const char* path, int flags)
+{
+    _violation("open64");
+    return __real___open64_2(path, flags);
+}
+
+ssize_t __wrap_read(int fd, void* buffer, size_t size)
+{
+    _violation("read");
+    return __real_read(fd, buffer, size);
+}
+
+ssize_t __wrap___read_chk(int fd, void* buffer, size_t size, size_t bufferSize)
+{
+    _violation("read");
+    return __real___read_chk(fd, buffer, size, bufferSize);
+}
+
+ssize_t __wrap_write(int fd, const void* buffer, size_t size)
+{
+    _violation("write");
+    return __real_write(fd, buffer, size);
+}
+
+FILE* __wrap_fopen(const char* path, const char* mode)
+{
+    _violation("fopen");
+    return __real_fopen(path, mode);
+}
+
+FILE* __wrap_fopen64(const char* path, const char* mode)
+{
+    _violation("fopen64");
+    return __real_fopen64(path, mode);
+}
+
+size_t __wrap_fread(void* buffer, size_t size, size_t count, FILE* file)
+{
+    _violation("fread");
+    return __real_fread(buffer, size, count, file);
+}
+
+size_t __wrap___fread_chk(void* buffer, size_t bufferSize, size_t size, size_t count, FILE* file)
+{
+    _violation("fread");
+    return __real___fread_chk(buffer, bufferSize, size, count, file);
+}
+
+size_t __wrap_fwrite(const void* buffer, size_t size, size_t count, FILE* file)
+{
+    _violation("fwrite");
+    return __real_fwrite(buffer, size, count, file);
+}
+}
+
+#endif
@@ -0,0 +1,77 @@
+/*
+    YoshimiRtCheck
+
+    Copyright 2023, AnClark Liu <anclarkliu@outlook.com>
+
+    This file is part of yoshimi, which is free software: you can
+    redistribute it and/or modify it under the terms of the GNU General
+    Public License as published by the Free Software Foundation, either
+    version 2 of the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with yoshimi.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef YOSHIMI_RT_CHECK_H
+#define YOSHIMI_RT_CHECK_H
+
+/**
+ * Real-time safety checker. Testing aid, only built with CMake option YoshimiRtCheck.
+ *
+ * The plugin declares itself RT-safe (DISTRHO_PLUGIN_IS_RT_SAFE), but run() goes a long way
+ * into the engine. With the checker on, run() is marked as a real-time span, and calls made from
+ * within it to the allocator (malloc / free / new / delete), mutex locks, semaphore waits and file I/O
+ * are intercepted (by the linker, with --wrap; see CMakeLists.txt) and recorded with a backtrace.
+ *
+ * What is not caught:
+ *   - Calls made inside shared libraries (libstdc++, libc, fftw, mxml, zlib...). --wrap only
+ *     redirects references from the objects linked into the plugin itself, i.e. the plugin and
+ *     Yoshimi core sources. Allocations made by inline / template code of the standard library
+ *     are caught, since that code is compiled into our objects.
+ *   - Functions not in the wrap list. Note that headers may redirect a call to another symbol:
+ *     _FILE_OFFSET_BITS=64 turns open / fopen into open64 / fopen64, and _FORTIFY_SOURCE turns
+ *     read / fread / open into __read_chk / __fread_chk / __open_2. Those are in the list,
+ *     other redirected variants (pread, __pread_chk, openat...) are not.
+ *
+ * Recording is lock-free and allocation-free. Violations are printed to stderr by report(),
+ * from a non-RT thread (deactivate, instance destruction).
+ *
+ * Environment:
+ *   YOSHIMI_RT_CHECK_ABORT=1   abort() on the first violation, to make a headless CI render fail.
+ *
+ * Without YOSHIMI_RT_CHECK, everything here compiles to nothing.
+ */
+namespace YoshimiRtCheck {
+#if YOSHIMI_RT_CHECK
+    // Call once per instance, from a non-RT thread
+    void init();
+
+    // Print violations recorded since the last report. Returns how many in total so far.
+    unsigned int report();
+
+    void enterRealtime();
+    void leaveRealtime();
+#else
+    inline void         init() { }
+    inline unsigned int report() { return 0; }
+    inline void         enterRealtime() { }
+    inline void         leaveRealtime() { }
+#endif
+
+    // Mark the calling thread real-time for the lifetime of this object
+    class ScopedRealtime {
+    public:
+        ScopedRealtime() { enterRealtime(); }
+        ~ScopedRealtime() { leaveRealtime(); }
+
+        ScopedRealtime(const ScopedRealtime&)            = delete;
+        ScopedRealtime& operator=(const ScopedRealtime&) = delete;
+    };
+}
+
+#endif
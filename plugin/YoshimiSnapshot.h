@@ -0,0 +1,111 @@
+/*
+    YoshimiSnapshot
+
+    Copyright 2023, AnClark Liu <anclarkliu@outlook.com>
+
+    This file is part of yoshimi, which is free software: you can
+    redistribute it and/or modify it under the terms of the GNU General
+    Public License as published by the Free Software Foundation, either
+    version 2 of the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with yoshimi.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef YOSHIMI_SNAPSHOT_H
+#define YOSHIMI_SNAPSHOT_H
+
+#include "Misc/SynthEngine.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * Engine values shown by the editor, as of the end of the last processed block.
+ */
+struct YoshimiSnapshotData {
+    float   volume;
+    float   globalDetune;
+    int32_t keyShift;
+    float   peakL, peakR; // Output meters, 0.0 ~ 1.0 (may exceed on clipping)
+    uint8_t partEnabled[NUM_MIDI_PARTS];
+
+    uint32_t commandsApplied; // Editor's command queue position, see CommandQueue::flushed()
+};
+
+/**
+ * Seqlock around YoshimiSnapshotData.
+ *
+ * The audio thread owns the engine, so it is the one to copy out what the editor needs,
+ * once per run(). The editor then never touches engine structures, and never blocks the
+ * audio thread: reading is wait-free, with a bounded number of retries if a publish
+ * happens meanwhile. A failed read leaves the caller's previous copy untouched.
+ *
+ * Single writer. Data is stored as atomic words, so that concurrent reads are not data races.
+ */
+class YoshimiSnapshot {
+    static constexpr uint32_t kWords       = (sizeof(YoshimiSnapshotData) + 3) / 4;
+    static constexpr int      kMaxAttempts = 4;
+
+    std::atomic<uint32_t> fSequence; // Odd while a publish is in progress
+    std::atomic<uint32_t> fWords[kWords];
+
+public:
+    YoshimiSnapshot()
+        : fSequence(0)
+    {
+        for (uint32_t i = 0; i < kWords; i++)
+            fWords[i].store(0, std::memory_order_relaxed);
+    }
+
+    // Writer (audio thread)
+    void publish(const YoshimiSnapshotData& data)
+    {
+        uint32_t words[kWords] = {};
+        std::memcpy(words, &data, sizeof(data));
+
+        const uint32_t sequence = fSequence.load(std::memory_order_relaxed);
+
+        fSequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (uint32_t i = 0; i < kWords; i++)
+            fWords[i].store(words[i], std::memory_order_relaxed);
+
+        fSequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    // Readers (any thread)
+    bool read(YoshimiSnapshotData& data) const
+    {
+        for (int attempt = 0; attempt < kMaxAttempts; attempt++) {
+            const uint32_t sequence = fSequence.load(std::memory_order_acquire);
+            if (sequence & 1)
+                continue;
+
+            uint32_t words[kWords];
+            for (uint32_t i = 0; i < kWords; i++)
+                words[i] = fWords[i].load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (fSequence.load(std::memory_order_relaxed) != sequence)
+                continue;
+
+            std::memcpy(&data, words, sizeof(data));
+            return true;
+        }
+
+        return false;
+    }
+
+    YoshimiSnapshot(const YoshimiSnapshot&)            = delete;
+    YoshimiSnapshot& operator=(const YoshimiSnapshot&) = delete;
+};
+
+#endif
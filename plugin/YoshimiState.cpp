@@ -0,0 +1,197 @@
+/*
+    YoshimiState
+
+    Copyright 2023, AnClark Liu <anclarkliu@outlook.com>
+
+    This file is part of yoshimi, which is free software: you can
+    redistribute it and/or modify it under the terms of the GNU General
+    Public License as published by the Free Software Foundation, either
+    version 2 of the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with yoshimi.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "YoshimiState.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <zlib.h>
+
+static constexpr char   kMagic[]      = "YSTATE1:";
+static constexpr size_t kMagicLength  = sizeof(kMagic) - 1;
+static constexpr size_t kHeaderLength = 4; // XML size
+
+// Anything bigger is not a Yoshimi state, but a corrupted one
+static constexpr uint32_t kMaxXmlSize = 256 * 1024 * 1024;
+
+static constexpr char kBase64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// ----------------------------------------------------------------------------------------------------------------
+// Base64 helpers
+
+static size_t _base64Encode(const unsigned char* in, size_t size, char* out)
+{
+    size_t o = 0;
+
+    for (size_t i = 0; i < size; i += 3) {
+        const uint32_t n = (uint32_t)in[i] << 16
+            | (i + 1 < size ? (uint32_t)in[i + 1] << 8 : 0)
+            | (i + 2 < size ? (uint32_t)in[i + 2] : 0);
+
+        out[o++] = kBase64Chars[(n >> 18) & 63];
+        out[o++] = kBase64Chars[(n >> 12) & 63];
+        out[o++] = i + 1 < size ? kBase64Chars[(n >> 6) & 63] : '=';
+        out[o++] = i + 2 < size ? kBase64Chars[n & 63] : '=';
+    }
+
+    return o;
+}
+
+static int _base64Value(char c)
+{
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A';
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 26;
+    if (c >= '0' && c <= '9')
+        return c - '0' + 52;
+    if (c == '+')
+        return 62;
+    if (c == '/')
+        return 63;
+    return -1;
+}
+
+// Returns decoded size, or 0 on malformed input
+static size_t _base64Decode(const char* in, size_t size, unsigned char* out)
+{
+    if (size % 4 != 0)
+        return 0;
+
+    size_t o = 0;
+
+    for (size_t i = 0; i < size; i += 4) {
+        uint32_t n       = 0;
+        int      padding = 0;
+
+        for (size_t j = 0; j < 4; ++j) {
+            const char c = in[i + j];
+
+            if (c == '=' && i + 4 == size && j >= 2) {
+                n <<= 6;
+                ++padding;
+                continue;
+            }
+
+            const int value = _base64Value(c);
+            if (value < 0 || padding > 0)
+                return 0;
+
+            n = (n << 6) | (uint32_t)value;
+        }
+
+        out[o++] = (n >> 16) & 0xff;
+        if (padding < 2)
+            out[o++] = (n >> 8) & 0xff;
+        if (padding < 1)
+            out[o++] = n & 0xff;
+    }
+
+    return o;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+// State encoding
+
+bool YoshimiState::isEncoded(const char* value)
+{
+    return value && strncmp(value, kMagic, kMagicLength) == 0;
+}
+
+char* YoshimiState::encode(const char* xml)
+{
+    const size_t xmlSize = strlen(xml);
+    if (xmlSize > kMaxXmlSize)
+        return nullptr;
+
+    uLongf         packedSize = compressBound(xmlSize);
+    unsigned char* packed     = (unsigned char*)malloc(kHeaderLength + packedSize);
+    if (!packed)
+        return nullptr;
+
+    packed[0] = xmlSize & 0xff;
+    packed[1] = (xmlSize >> 8) & 0xff;
+    packed[2] = (xmlSize >> 16) & 0xff;
+    packed[3] = (xmlSize >> 24) & 0xff;
+
+    // States are saved on every autosave, so favour speed. XML still shrinks roughly tenfold.
+    if (compress2(packed + kHeaderLength, &packedSize, (const Bytef*)xml, xmlSize, Z_BEST_SPEED) != Z_OK) {
+        free(packed);
+        return nullptr;
+    }
+
+    const size_t rawSize = kHeaderLength + packedSize;
+    char*        encoded = (char*)malloc(kMagicLength + (rawSize + 2) / 3 * 4 + 1);
+    if (!encoded) {
+        free(packed);
+        return nullptr;
+    }
+
+    memcpy(encoded, kMagic, kMagicLength);
+    const size_t length = kMagicLength + _base64Encode(packed, rawSize, encoded + kMagicLength);
+    encoded[length]     = '\0';
+
+    free(packed);
+    return encoded;
+}
+
+char* YoshimiState::decode(const char* value, size_t* xmlSize)
+{
+    if (!isEncoded(value))
+        return nullptr;
+
+    const char*    body     = value + kMagicLength;
+    const size_t   bodySize = strlen(body);
+    unsigned char* raw      = (unsigned char*)malloc(bodySize / 4 * 3 + 1);
+    if (!raw)
+        return nullptr;
+
+    const size_t rawSize = _base64Decode(body, bodySize, raw);
+    if (rawSize <= kHeaderLength) {
+        free(raw);
+        return nullptr;
+    }
+
+    const uint32_t size = (uint32_t)raw[0]
+        | (uint32_t)raw[1] << 8
+        | (uint32_t)raw[2] << 16
+        | (uint32_t)raw[3] << 24;
+
+    char* xml = size <= kMaxXmlSize ? (char*)malloc(size + 1) : nullptr;
+    if (!xml) {
+        free(raw);
+        return nullptr;
+    }
+
+    uLongf unpackedSize = size;
+    if (uncompress((Bytef*)xml, &unpackedSize, raw + kHeaderLength, rawSize - kHeaderLength) != Z_OK
+        || unpackedSize != size) {
+        free(raw);
+        free(xml);
+        return nullptr;
+    }
+
+    xml[size] = '\0';
+    if (xmlSize)
+        *xmlSize = size;
+
+    free(raw);
+    return xml;
+}
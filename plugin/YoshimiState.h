@@ -0,0 +1,48 @@
+/*
+    YoshimiState
+
+    Copyright 2023, AnClark Liu <anclarkliu@outlook.com>
+
+    This file is part of yoshimi, which is free software: you can
+    redistribute it and/or modify it under the terms of the GNU General
+    Public License as published by the Free Software Foundation, either
+    version 2 of the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with yoshimi.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef YOSHIMI_STATE_H
+#define YOSHIMI_STATE_H
+
+#include <cstddef>
+
+/**
+ * Compact encoding of the plugin state, as stored by hosts.
+ *
+ * Yoshimi's own state is the XML from SynthEngine::getalldata(), which is huge for multi-part
+ * setups and gets saved into every project and autosave. We store it deflated instead:
+ *
+ *   "YSTATE1:" base64( uint32 little-endian XML size, zlib stream )
+ *
+ * DPF states are C strings, hence the base64 armour. The number after "YSTATE" is the format
+ * version. Plain XML (older projects, hand-made presets) is still accepted when loading.
+ *
+ * Saving in this encoding is opt-in (CMake option CompactPluginState, YOSHIMI_COMPACT_STATE):
+ * it costs a deflate and base64 pass on every uncached save, and projects saved that way
+ * cannot be loaded by releases before it. Loading it is always supported.
+ *
+ * Returned buffers are allocated with malloc(), ready to be owned by DISTRHO::String.
+ */
+namespace YoshimiState {
+    bool  isEncoded(const char* value);
+    char* encode(const char* xml);
+    char* decode(const char* value, size_t* xmlSize = nullptr);
+}
+
+#endif
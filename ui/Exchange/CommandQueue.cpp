@@ -0,0 +1,272 @@
+#include "CommandQueue.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+
+YoshimiExchange::CommandQueue::CommandQueue()
+    : fSlotsUsed(0)
+    , fHead(0)
+    , fTail(0)
+    , fLimitsFrom(0)
+    , fLimitsStale(false)
+{
+    for (uint32_t i = 0; i < kNumSlots; i++) {
+        fSlots[i].queued.store(false);
+        fSlots[i].position.store(0);
+    }
+}
+
+/**
+ * Queue a command.
+ *
+ * Plain value writes go to the slot of their control address. If that slot is already waiting
+ * in the ring, only its value is updated, so a slider drag costs one entry per audio block at most.
+ */
+bool YoshimiExchange::CommandQueue::push(const CommandBlock& putData)
+{
+    const bool pushed = _isCoalescable(putData) ? _pushSlot(putData) : _pushEntry(kInlineEntry, putData);
+
+    /*
+     * May change the limits of other controls: effect type and kit mode are integer writes,
+     * instrument loads are inline commands. Values of a slider drag keep the cache.
+     */
+    if (pushed && (!_isCoalescable(putData) || (putData.data.type & TOPLEVEL::type::Integer))) {
+        fLimits.clear();
+        fLimitsFrom = fHead.load(std::memory_order_relaxed);
+    }
+
+    return pushed;
+}
+
+float YoshimiExchange::CommandQueue::readLimits(SynthEngine* synth, CommandBlock* putData)
+{
+    if (fLimitsStale.exchange(false, std::memory_order_acquire))
+        fLimits.clear();
+
+    // A structure change is still on its way to the engine, what it answers now may not last
+    const bool cacheable = (int32_t)(flushed() - fLimitsFrom) >= 0;
+
+    const uint64_t address = _addressOf(*putData, false);
+    Limits         limits;
+
+    auto it = cacheable ? fLimits.find(address) : fLimits.end();
+    if (it != fLimits.end()) {
+        limits = it->second;
+    } else {
+        limits = _queryLimits(synth, *putData);
+
+        if (cacheable)
+            fLimits.emplace(address, limits);
+    }
+
+    if (limits.passThrough)
+        return synth->interchange.readAllData(putData);
+
+    float result;
+
+    switch (putData->data.type & TOPLEVEL::type::Default) {
+        case TOPLEVEL::type::Minimum:
+            result = limits.min;
+            break;
+        case TOPLEVEL::type::Maximum:
+            result = limits.max;
+            break;
+        case TOPLEVEL::type::Default:
+            result = limits.def;
+            break;
+        default: // Adjust
+            result = std::min(std::max(putData->data.value, limits.min), limits.max);
+            if (limits.type & TOPLEVEL::type::Integer)
+                result = std::round(result);
+            break;
+    }
+
+    putData->data.type |= limits.type;
+    return result;
+}
+
+void YoshimiExchange::CommandQueue::flush(SynthEngine* synth)
+{
+    const uint32_t head = fHead.load(std::memory_order_acquire);
+    uint32_t       tail = fTail.load(std::memory_order_relaxed);
+
+    for (; tail != head; ++tail) {
+        const Entry& entry   = fRing[tail & (kRingSize - 1)];
+        bool         cleared = false;
+        CommandBlock putData;
+
+        if (entry.slot == kInlineEntry) {
+            putData = entry.cmd;
+        } else {
+            Slot& slot = fSlots[entry.slot];
+
+            /*
+             * Clear first, then read: a value stored in this entry after this point queues a new one.
+             * Only if this is the slot's latest entry. An older one, left behind by later commands
+             * (see _pushSlot()), still carries its own value and is sent as it is.
+             */
+            cleared = slot.position.load() == tail;
+            if (cleared)
+                slot.queued.store(false);
+
+            putData            = slot.cmd;
+            putData.data.value = entry.value.load();
+        }
+
+        // Engine's ring is full, try again next block
+        if (!synth->interchange.fromCLI.write(putData.bytes)) {
+            if (cleared)
+                fSlots[entry.slot].queued.store(true);
+            break;
+        }
+    }
+
+    fTail.store(tail, std::memory_order_release);
+}
+
+bool YoshimiExchange::CommandQueue::_pushSlot(const CommandBlock& putData)
+{
+    const uint64_t address = _addressOf(putData, true);
+    uint16_t       index;
+
+    auto it = fSlotIndex.find(address);
+    if (it != fSlotIndex.end()) {
+        index = it->second;
+
+        // Same address, different flags (e.g. Integer). Rare enough to not deserve a slot of its own.
+        if (fSlots[index].cmd.data.type != putData.data.type)
+            return _pushEntry(kInlineEntry, putData);
+    } else {
+        // Out of slots: still works, just without coalescing
+        if (fSlotsUsed == kNumSlots)
+            return _pushEntry(kInlineEntry, putData);
+
+        index               = fSlotsUsed++;
+        fSlots[index].cmd   = putData;
+        fSlotIndex[address] = index;
+    }
+
+    Slot&          slot     = fSlots[index];
+    const uint32_t head     = fHead.load(std::memory_order_relaxed);
+    const uint32_t position = slot.position.load(std::memory_order_relaxed);
+
+    /*
+     * Values live in ring entries. The slot's latest entry takes the new value in place only while
+     * nothing was queued after it, so a value is never applied ahead of a command sent before it.
+     * Otherwise the older entry keeps its value, and a new one is queued at the end.
+     */
+    if (slot.queued.load() && position + 1 == head) {
+        fRing[position & (kRingSize - 1)].value.store(putData.data.value);
+
+        // Not taken by flush() yet: it clears queued before reading the value, so it will see this one
+        if (slot.queued.load())
+            return true;
+
+        // Taken meanwhile, maybe with the previous value. Queue this one anew.
+    }
+
+    slot.position.store(head);
+    slot.queued.store(true);
+
+    if (!_pushEntry(index, putData)) {
+        slot.queued.store(false);
+        return false;
+    }
+
+    return true;
+}
+
+bool YoshimiExchange::CommandQueue::_pushEntry(uint16_t slot, const CommandBlock& putData)
+{
+    const uint32_t head = fHead.load(std::memory_order_relaxed);
+
+    if (head - fTail.load(std::memory_order_acquire) >= kRingSize)
+        return false;
+
+    Entry& entry = fRing[head & (kRingSize - 1)];
+    entry.slot   = slot;
+    entry.cmd    = putData;
+    entry.value.store(putData.data.value, std::memory_order_relaxed);
+
+    fHead.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+YoshimiExchange::CommandQueue::Limits YoshimiExchange::CommandQueue::_queryLimits(SynthEngine* synth, const CommandBlock& putData)
+{
+    CommandBlock query = putData;
+    Limits       limits;
+
+    query.data.type = TOPLEVEL::type::Minimum | TOPLEVEL::type::Limits;
+    limits.min      = synth->interchange.readAllData(&query);
+
+    query           = putData;
+    query.data.type = TOPLEVEL::type::Maximum | TOPLEVEL::type::Limits;
+    limits.max      = synth->interchange.readAllData(&query);
+
+    query           = putData;
+    query.data.type = TOPLEVEL::type::Default | TOPLEVEL::type::Limits;
+    limits.def      = synth->interchange.readAllData(&query);
+    limits.type     = query.data.type & (TOPLEVEL::type::Integer | TOPLEVEL::type::Learnable | TOPLEVEL::type::Error);
+
+    /*
+     * Some commands (e.g. loadInstrumentFromBank) have no range of their own,
+     * and their "default" is whatever value was given. Probe with another value to find out.
+     */
+    query              = putData;
+    query.data.type    = TOPLEVEL::type::Default | TOPLEVEL::type::Limits;
+    query.data.value   = putData.data.value + 1.0f;
+    limits.passThrough = synth->interchange.readAllData(&query) != limits.def;
+
+    return limits;
+}
+
+bool YoshimiExchange::CommandQueue::_isCoalescable(const CommandBlock& putData)
+{
+    return (putData.data.type & TOPLEVEL::type::Write)
+        && !(putData.data.type & TOPLEVEL::type::LearnRequest)
+        && putData.data.part != TOPLEVEL::section::midiLearn
+        && putData.data.miscmsg == NO_MSG;
+}
+
+uint64_t YoshimiExchange::CommandQueue::_addressOf(const CommandBlock& putData, bool withSource)
+{
+    return uint64_t(putData.data.control)
+        | uint64_t(putData.data.part) << 8
+        | uint64_t(putData.data.kit) << 16
+        | uint64_t(putData.data.engine) << 24
+        | uint64_t(putData.data.insert) << 32
+        | uint64_t(putData.data.parameter) << 40
+        | uint64_t(putData.data.offset) << 48
+        | uint64_t(withSource ? putData.data.source : 0) << 56;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+// Registry
+
+namespace {
+    std::mutex                                              queueRegistryMutex;
+    std::map<SynthEngine*, YoshimiExchange::CommandQueue*> queueRegistry;
+}
+
+void YoshimiExchange::registerCommandQueue(SynthEngine* synth, CommandQueue* queue)
+{
+    std::lock_guard<std::mutex> lock(queueRegistryMutex);
+    queueRegistry[synth] = queue;
+}
+
+void YoshimiExchange::unregisterCommandQueue(SynthEngine* synth)
+{
+    std::lock_guard<std::mutex> lock(queueRegistryMutex);
+    queueRegistry.erase(synth);
+}
+
+YoshimiExchange::CommandQueue* YoshimiExchange::getCommandQueue(SynthEngine* synth)
+{
+    std::lock_guard<std::mutex> lock(queueRegistryMutex);
+
+    auto it = queueRegistry.find(synth);
+    return it != queueRegistry.end() ? it->second : nullptr;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "Misc/SynthEngine.h"
+
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+
+/**
+ * UI-to-DSP command channel.
+ *
+ * The editor redraws every frame, and a dragged slider sends one command per frame.
+ * Writing each of them into interchange.fromCLI floods that ring, and what does not fit is dropped.
+ * Here, value writes are kept in a slot per control address instead: a slot is queued only once
+ * until the audio thread picks it up, and is sent with whatever value it holds at that moment.
+ * Other commands (instrument loads, text messages, MIDI learn...) are queued as they are, in order.
+ *
+ * A slot's value is updated in its ring entry only while nothing was queued after it. Otherwise
+ * a new entry is queued at the end, so that a value is never applied before a command sent earlier.
+ *
+ * Limits checks (min / max / default, learnable) are cached per control address as well,
+ * so they only reach into the engine the first time a control is touched. The cache is dropped
+ * on anything that may change other controls' limits: integer writes (effect type, kit mode...),
+ * other commands (instrument loads...) and state loads. It is not refilled until those commands
+ * have been handed over to the engine.
+ *
+ * Threading: single producer (UI thread: push(), readLimits()), single consumer (audio thread: flush()).
+ * flush() is called at the beginning of each run(), and moves the pending commands into fromCLI,
+ * which the engine mediates right after, within the same block.
+ */
+
+namespace YoshimiExchange {
+    class CommandQueue {
+    public:
+        CommandQueue();
+
+        /**
+         * Queue a command. Returns false if the queue is full.
+         * UI thread only.
+         */
+        bool push(const CommandBlock& putData);
+
+        /**
+         * Same as interchange.readAllData() for limits requests (type & TOPLEVEL::type::Limits),
+         * but cached per control address. UI thread only.
+         */
+        float readLimits(SynthEngine* synth, CommandBlock* putData);
+
+        /**
+         * Drop cached limits, e.g. after a state load.
+         * Any thread, takes effect at the next readLimits().
+         */
+        void invalidateLimits() { fLimitsStale.store(true, std::memory_order_release); }
+
+        /**
+         * Hand queued commands over to the engine. Stops early if fromCLI is full,
+         * the rest is kept until next call. Audio thread only.
+         */
+        void flush(SynthEngine* synth);
+
+        /**
+         * Queue positions, counting entries since construction (wrapping around).
+         * A command pushed when pushed() returned N has been handed over once flushed() passes N.
+         */
+        uint32_t pushed() const { return fHead.load(std::memory_order_acquire); }
+        uint32_t flushed() const { return fTail.load(std::memory_order_acquire); }
+
+    private:
+        static constexpr uint32_t kNumSlots    = 512;
+        static constexpr uint32_t kRingSize    = 1024; // must be a power of 2
+        static constexpr uint16_t kInlineEntry = 0xffff;
+
+        struct Slot {
+            CommandBlock          cmd;      // address, written once before the slot is first queued
+            std::atomic<bool>     queued;   // Latest entry not taken by flush() yet
+            std::atomic<uint32_t> position; // Ring position of its latest entry
+        };
+
+        struct Entry {
+            uint16_t           slot; // kInlineEntry if cmd is to be sent as it is
+            CommandBlock       cmd;
+            std::atomic<float> value; // Slot entries: value to send, updated while the entry is last
+        };
+
+        struct Limits {
+            float         min, max, def;
+            unsigned char type;        // Integer / Learnable / Error flags
+            bool          passThrough; // Limits depend on the value itself, not cacheable
+        };
+
+        Slot     fSlots[kNumSlots];
+        uint32_t fSlotsUsed;
+
+        Entry                 fRing[kRingSize];
+        std::atomic<uint32_t> fHead, fTail;
+
+        // UI thread only
+        std::unordered_map<uint64_t, uint16_t> fSlotIndex;
+        std::unordered_map<uint64_t, Limits>   fLimits;
+        uint32_t                               fLimitsFrom; // Not cached until flushed() reaches this
+
+        std::atomic<bool> fLimitsStale;
+
+        bool _pushSlot(const CommandBlock& putData);
+        bool _pushEntry(uint16_t slot, const CommandBlock& putData);
+
+        Limits _queryLimits(SynthEngine* synth, const CommandBlock& putData);
+
+        static bool     _isCoalescable(const CommandBlock& putData);
+        static uint64_t _addressOf(const CommandBlock& putData, bool withSource);
+    };
+
+    // ----------------------------------------------------------------------------------------------------------------
+    // Registry
+    // Exchange functions only get a synth instance, this is how they find its queue.
+
+    void          registerCommandQueue(SynthEngine* synth, CommandQueue* queue);
+    void          unregisterCommandQueue(SynthEngine* synth);
+    CommandQueue* getCommandQueue(SynthEngine* synth);
+}
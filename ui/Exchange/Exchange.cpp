@@ -1,6 +1,27 @@
 #include "Exchange.hpp"
+#include "CommandQueue.hpp"
 #include "Misc/TextMsgBuffer.h"
 
+/**
+ * Route limits checks and writes through the synth's command queue, if the plugin has set one up.
+ * See CommandQueue.hpp
+ */
+static float readLimits(SynthEngine* synth, CommandBlock* putData)
+{
+    if (YoshimiExchange::CommandQueue* queue = YoshimiExchange::getCommandQueue(synth))
+        return queue->readLimits(synth, putData);
+
+    return synth->interchange.readAllData(putData);
+}
+
+static bool writeCommand(SynthEngine* synth, const CommandBlock& putData)
+{
+    if (YoshimiExchange::CommandQueue* queue = YoshimiExchange::getCommandQueue(synth))
+        return queue->push(putData);
+
+    return synth->interchange.fromCLI.write(putData.bytes);
+}
+
 /**
  * Send action to synth engine. (CLI method)
  *
@@ -45,7 +66,7 @@ int YoshimiExchange::sendNormal(SynthEngine*  synth,
 
     if (part != TOPLEVEL::section::midiLearn) {
         putData.data.type |= TOPLEVEL::type::Limits;
-        float newValue = synth->interchange.readAllData(&putData);
+        float newValue = readLimits(synth, &putData);
         if (type & TOPLEVEL::type::LearnRequest) {
             if ((putData.data.type & TOPLEVEL::type::Learnable) == 0) {
                 synth->getRuntime().Log("Can't learn this control");
@@ -63,10 +84,10 @@ int YoshimiExchange::sendNormal(SynthEngine*  synth,
     }
     putData.data.source = action;
     putData.data.type   = type;
-    if (synth->interchange.fromCLI.write(putData.bytes)) {
+    if (writeCommand(synth, putData)) {
         synth->getRuntime().finishedCLI = false;
     } else {
-        synth->getRuntime().Log("Unable to write to fromCLI buffer");
+        synth->getRuntime().Log("Unable to write to command queue");
         return REPLY::failed_msg;
     }
     return REPLY::done_msg;
@@ -106,7 +127,7 @@ int YoshimiExchange::sendDirect(SynthEngine*  synth,
 
     if (type == TOPLEVEL::type::Default) {
         putData.data.type = TOPLEVEL::type::Limits;
-        synth->interchange.readAllData(&putData);
+        readLimits(synth, &putData);
         if ((putData.data.type & TOPLEVEL::type::Learnable) == 0) {
             synth->getRuntime().Log("Can't learn this control");
             return 0;
@@ -124,7 +145,7 @@ int YoshimiExchange::sendDirect(SynthEngine*  synth,
     putData.data.type   = type;
     if (request < TOPLEVEL::type::Limits) {
         putData.data.type = request | TOPLEVEL::type::Limits;
-        value             = synth->interchange.readAllData(&putData);
+        value             = readLimits(synth, &putData);
         string name;
         switch (request) {
             case TOPLEVEL::type::Minimum:
@@ -194,10 +215,10 @@ int YoshimiExchange::sendDirect(SynthEngine*  synth,
         action |= (parameter & TOPLEVEL::action::muteAndLoop); // transfer low prio and loopback
     putData.data.source = action;
 
-    if (synth->interchange.fromCLI.write(putData.bytes)) {
+    if (writeCommand(synth, putData)) {
         synth->getRuntime().finishedCLI = false;
     } else
-        synth->getRuntime().Log("Unable to write to fromCLI buffer");
+        synth->getRuntime().Log("Unable to write to command queue");
     return 0; // no function for this yet
 }
 
@@ -223,6 +244,9 @@ float YoshimiExchange::collect_readData(SynthEngine* synth, float value, unsigne
     putData.data.offset    = offset;
     putData.data.miscmsg   = miscmsg;
 
+    if (type & TOPLEVEL::type::Limits)
+        return readLimits(synth, &putData);
+
     float result;
     if (miscmsg != NO_MSG) {
         synth->interchange.readAllData(&putData);
@@ -258,7 +282,7 @@ void YoshimiExchange::collect_data(SynthEngine* synth, float value, unsigned cha
     // check range & if learnable
     float newValue;
     putData.data.type = 3 | TOPLEVEL::type::Limits;
-    newValue          = synth->interchange.readAllData(&putData);
+    newValue          = readLimits(synth, &putData);
 
     putData.data.value = newValue;
     type               = TOPLEVEL::type::Write;
@@ -317,8 +341,9 @@ void YoshimiExchange::collect_data(SynthEngine* synth, float value, unsigned cha
      * Official FLTK uses synth->interchange.fromGUI, but I don't use FLTK in reformed project,
      * because synth engine and FLTK are highly coupled.
      * Use fromCLI instead. (This requires LV2 build in yoshimi tree is disabled.)
+     * Commands reach fromCLI via the command queue, see CommandQueue.hpp
      */
-    if (!synth->interchange.fromCLI.write(putData.bytes))
+    if (!writeCommand(synth, putData))
         // synth->getRuntime().Log("Unable to write to fromGUI buffer.");
-        synth->getRuntime().Log("Unable to write to fromCLI buffer.");
+        synth->getRuntime().Log("Unable to write to command queue.");
 }